@@ -0,0 +1,242 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logentry.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace UFW
+{
+
+#define MARKER     " [UFW "
+#define MARKER_LEN 6
+
+static inline bool isKey(const char *key, int keyLen, const char *str, int strLen)
+{
+    return keyLen==strLen && 0==memcmp(key, str, strLen);
+}
+
+// Next space separated token within [pos, end) - skipping leading spaces
+static inline LogField nextToken(const char *&pos, const char *end)
+{
+    while(pos<end && ' '==*pos)
+        ++pos;
+
+    const char *start=pos;
+    const char *space=(const char *)memchr(pos, ' ', end-pos);
+
+    pos=space ? space : end;
+    return LogField(start, pos-start);
+}
+
+uint LogField::toUInt(bool *ok) const
+{
+    uint val=0;
+
+    for(int i=0; i<length; ++i)
+    {
+        if(data[i]<'0' || data[i]>'9')
+        {
+            if(ok)
+                *ok=false;
+            return 0;
+        }
+        val=(val*10)+(data[i]-'0');
+    }
+    if(ok)
+        *ok=length>0;
+    return val;
+}
+
+const char * LogEntry::findMarker(const char *data, int length)
+{
+    const char *pos=data,
+               *end=data+length;
+
+#ifdef __SSE2__
+    // Check 16 positions at a time for the '[' and 'W' of the marker, and only compare the whole marker where both
+    // are found. UFW lines are usually a small part of the log, so most blocks have no candidates at all.
+    const __m128i bracket=_mm_set1_epi8('['),
+                  w=_mm_set1_epi8('W');
+
+    for(; pos+MARKER_LEN+15<=end; pos+=16)
+    {
+        unsigned int mask=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pos+1)), bracket),
+                                                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pos+4)), w)));
+
+        for(; mask; mask&=mask-1)
+        {
+            const char *candidate=pos+__builtin_ctz(mask);
+
+            if(0==memcmp(candidate, MARKER, MARKER_LEN))
+                return candidate;
+        }
+    }
+#endif
+
+    // Remainder (or everything, without SSE2) - look for each '[', and check if it is part of the marker
+    const char *last=end-MARKER_LEN; // Last possible start of the marker
+
+    while(pos<=last)
+    {
+        const char *open=(const char *)memchr(pos+1, '[', last-pos+1);
+
+        if(!open)
+            return 0L;
+        if(0==memcmp(open-1, MARKER, MARKER_LEN))
+            return open-1;
+        pos=open;
+    }
+    return 0L;
+}
+
+bool LogEntry::parse(const char *data, int length)
+{
+    while(length>0 && ('\n'==data[length-1] || '\r'==data[length-1]))
+        --length;
+
+    const char *end=data+length,
+               *marker=findMarker(data, length);
+
+    *this=LogEntry();
+    if(!marker)
+        return false;
+
+    line=LogField(data, length);
+
+    // Timestamp and host - BSD syslog timestamps are 3 tokens, ISO timestamps (which start with the year) are 1
+    const char *pos=data;
+    LogField   token=nextToken(pos, marker);
+
+    if(token.length && token.data[0]>='0' && token.data[0]<='9')
+        timestamp=token;
+    else
+    {
+        nextToken(pos, marker);
+        token=nextToken(pos, marker);
+        timestamp=LogField(data, token.data+token.length-data);
+    }
+    host=nextToken(pos, marker);
+
+    // Kernel time - the bracketed item before the marker, which may be padded with spaces
+    const char *close=marker;
+
+    while(close>pos && ' '==close[-1])
+        --close;
+    if(close>pos && ']'==close[-1])
+    {
+        const char *open=close-1;
+
+        while(open>pos && '['!=*open)
+            --open;
+        if('['==*open)
+        {
+            const char *start=open+1;
+
+            while(start<close-1 && ' '==*start)
+                ++start;
+            kernelTime=LogField(start, close-1-start);
+        }
+    }
+
+    // Action - up to the closing bracket
+    pos=marker+MARKER_LEN;
+
+    const char *actionEnd=(const char *)memchr(pos, ']', end-pos);
+
+    if(!actionEnd)
+        return false;
+    action=LogField(pos, actionEnd-pos);
+    pos=actionEnd+1;
+
+    // KEY=VALUE items, and flags
+    while(pos<end)
+    {
+        token=nextToken(pos, end);
+        if(token.isEmpty())
+            break;
+
+        const char *eq=(const char *)memchr(token.data, '=', token.length);
+
+        if(eq)
+        {
+            int      keyLen=eq-token.data;
+            LogField value(eq+1, token.length-keyLen-1);
+
+            switch(keyLen)
+            {
+                case 2:
+                    if(isKey("IN", 2, token.data, keyLen))
+                        in=value;
+                    break;
+                case 3:
+                    if(isKey("OUT", 3, token.data, keyLen))
+                        out=value;
+                    else if(isKey("MAC", 3, token.data, keyLen))
+                        mac=value;
+                    else if(isKey("SRC", 3, token.data, keyLen))
+                        src=value;
+                    else if(isKey("DST", 3, token.data, keyLen))
+                        dst=value;
+                    else if(isKey("LEN", 3, token.data, keyLen))
+                    {
+                        if(!len.data)
+                            len=value;
+                    }
+                    else if(isKey("TTL", 3, token.data, keyLen))
+                        ttl=value;
+                    else if(isKey("SPT", 3, token.data, keyLen))
+                        spt=value;
+                    else if(isKey("DPT", 3, token.data, keyLen))
+                        dpt=value;
+                    break;
+                case 5:
+                    if(isKey("PROTO", 5, token.data, keyLen))
+                        proto=value;
+                    break;
+            }
+        }
+        else if(token=="DF")
+            flags|=FLAG_DF;
+        else if(token=="MF")
+            flags|=FLAG_MF;
+        else if(token=="CE")
+            flags|=FLAG_CE;
+        else if(token=="SYN")
+            flags|=FLAG_SYN;
+        else if(token=="ACK")
+            flags|=FLAG_ACK;
+        else if(token=="FIN")
+            flags|=FLAG_FIN;
+        else if(token=="RST")
+            flags|=FLAG_RST;
+        else if(token=="PSH")
+            flags|=FLAG_PSH;
+        else if(token=="URG")
+            flags|=FLAG_URG;
+    }
+    return true;
+}
+
+}
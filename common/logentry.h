@@ -0,0 +1,102 @@
+#ifndef UFW_LOG_ENTRY_H
+#define UFW_LOG_ENTRY_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <QtCore/QString>
+#include <string.h>
+
+namespace UFW
+{
+
+//
+// Part of a log line. This does not copy the line, so is only valid whilst the buffer containing the line is.
+struct LogField
+{
+    LogField() : data(0L), length(0) { }
+    LogField(const char *d, int l) : data(d), length(l) { }
+
+    bool    isEmpty() const                   { return 0==length; }
+    bool    operator==(const char *str) const { return (int)strlen(str)==length && 0==memcmp(data, str, length); }
+    QString toString() const                  { return QString::fromUtf8(data, length); }
+    uint    toUInt(bool *ok=0L) const;
+
+    const char *data;
+    int        length;
+};
+
+//
+// The fields of a UFW kernel log line, e.g.
+//
+//   Apr  6 11:42:41 host kernel: [36122.101381] [UFW BLOCK] IN= OUT=eth0 SRC=1.2.3.4 DST=1.2.3.4 LEN=76 TOS=0x00
+//   PREC=0x00 TTL=64 ID=0 DF PROTO=UDP SPT=1 DPT=1 LEN=56
+//
+// The line is scanned once, and each field refers to its bytes within the line.
+class LogEntry
+{
+    public:
+
+    // Options and TCP flags - i.e. those items without a value
+    enum Flags
+    {
+        FLAG_DF  = 0x0001,
+        FLAG_MF  = 0x0002,
+        FLAG_CE  = 0x0004,
+        FLAG_SYN = 0x0008,
+        FLAG_ACK = 0x0010,
+        FLAG_FIN = 0x0020,
+        FLAG_RST = 0x0040,
+        FLAG_PSH = 0x0080,
+        FLAG_URG = 0x0100
+    };
+
+    // Position of the UFW marker (" [UFW ") within the given bytes, or 0L if not found
+    static const char * findMarker(const char *data, int length);
+
+    LogEntry() : flags(0) { }
+
+    // Returns false if this is not a UFW line
+    bool parse(const char *line, int length);
+
+    LogField line,       // Whole line, without any trailing newline
+             timestamp,  // Syslog time - e.g. "Apr  6 11:42:41", or "2011-04-06T11:42:41.123456+01:00"
+             host,
+             kernelTime, // Seconds since boot - e.g. "36122.101381"
+             action,     // e.g. "BLOCK", "ALLOW", "AUDIT"
+             in,
+             out,
+             mac,
+             src,
+             dst,
+             len,        // IP length - i.e. the first LEN
+             ttl,
+             proto,
+             spt,
+             dpt;
+    int      flags;
+};
+
+}
+
+#endif
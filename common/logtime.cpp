@@ -0,0 +1,187 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logtime.h"
+#include <time.h>
+
+namespace UFW
+{
+
+#define SECS_PER_HOUR (60*60)
+#define SECS_PER_DAY  (24*SECS_PER_HOUR)
+
+// Value of 'len' digits, or -1 if any are not digits
+static inline int toNum(const char *str, int len)
+{
+    int val=0;
+
+    for(int i=0; i<len; ++i)
+    {
+        if(str[i]<'0' || str[i]>'9')
+            return -1;
+        val=(val*10)+(str[i]-'0');
+    }
+    return val;
+}
+
+// Read "hh:mm:ss" as seconds into the day, or -1 if invalid
+static inline int toSecs(const char *str)
+{
+    int h=toNum(str, 2),
+        m=toNum(str+3, 2),
+        s=toNum(str+6, 2);
+
+    return h<0 || h>23 || m<0 || m>59 || s<0 || s>60 || ':'!=str[2] || ':'!=str[5] ? -1 : (h*60+m)*60+s;
+}
+
+// Month (0..11) from its abbreviated name - the letters are checked in turn, rather than comparing with each name
+static inline int toMonth(const char *str)
+{
+    switch(str[0])
+    {
+        case 'J':
+            return 'a'==str[1] ? ('n'==str[2] ? 0 : -1)
+                               : 'u'==str[1] ? ('n'==str[2] ? 5 : 'l'==str[2] ? 6 : -1) : -1;
+        case 'F':
+            return 'e'==str[1] && 'b'==str[2] ? 1 : -1;
+        case 'M':
+            return 'a'==str[1] ? ('r'==str[2] ? 2 : 'y'==str[2] ? 4 : -1) : -1;
+        case 'A':
+            return 'p'==str[1] && 'r'==str[2] ? 3 : 'u'==str[1] && 'g'==str[2] ? 7 : -1;
+        case 'S':
+            return 'e'==str[1] && 'p'==str[2] ? 8 : -1;
+        case 'O':
+            return 'c'==str[1] && 't'==str[2] ? 9 : -1;
+        case 'N':
+            return 'o'==str[1] && 'v'==str[2] ? 10 : -1;
+        case 'D':
+            return 'e'==str[1] && 'c'==str[2] ? 11 : -1;
+        default:
+            return -1;
+    }
+}
+
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar - 'm' is 0..11. Years are counted from March,
+// so that the leap day is the last day of the year.
+static inline qint64 toDays(int y, int m, int d)
+{
+    y-=m<2 ? 1 : 0;
+
+    int era=(y>=0 ? y : y-399)/400,
+        yoe=y-era*400,
+        doy=(153*(m<2 ? m+10 : m-2)+2)/5+d-1,
+        doe=yoe*365+yoe/4-yoe/100+doy;
+
+    return (qint64)era*146097+doe-719468;
+}
+
+qint64 LogTime::toTime(const LogField &timestamp, qint64 now)
+{
+    const char *str=timestamp.data,
+               *end=str+timestamp.length;
+
+    // ISO - e.g. "2011-04-06T11:42:41.123456+01:00"
+    if(timestamp.length>=19 && str[0]>='0' && str[0]<='9')
+    {
+        int y=toNum(str, 4),
+            m=toNum(str+5, 2)-1,
+            d=toNum(str+8, 2),
+            secs=toSecs(str+11);
+
+        if(y<0 || m<0 || m>11 || d<1 || d>31 || secs<0 || '-'!=str[4] || '-'!=str[7])
+            return 0;
+
+        const char *pos=str+19;
+
+        if(pos<end && '.'==*pos)
+            for(++pos; pos<end && *pos>='0' && *pos<='9'; ++pos)
+                ;
+        if(pos<end && 'Z'==*pos)
+            return toDays(y, m, d)*SECS_PER_DAY+secs;
+        if(end-pos>=6 && ('+'==*pos || '-'==*pos))
+        {
+            int zh=toNum(pos+1, 2),
+                zm=toNum(pos+4, 2);
+
+            if(zh<0 || zm<0)
+                return 0;
+            return toDays(y, m, d)*SECS_PER_DAY+secs-('+'==*pos ? 1 : -1)*((zh*60)+zm)*60;
+        }
+        return fromLocal(y, m, d, secs);
+    }
+
+    // BSD - e.g. "Apr  6 11:42:41"
+    if(timestamp.length<15)
+        return 0;
+
+    int m=toMonth(str),
+        d=toNum(' '==str[4] ? str+5 : str+4, ' '==str[4] ? 1 : 2),
+        secs=toSecs(str+7);
+
+    if(m<0 || d<1 || d>31 || secs<0)
+        return 0;
+
+    if(now<yearStart || now>=yearEnd)
+        setYear(now);
+
+    // The year is chosen using the current offset from UTC, so that only one time is looked up
+    bool   lastYear=toDays(year, m, d)*SECS_PER_DAY+secs-nowOffset>now+SECS_PER_DAY;
+    qint64 t=fromLocal(lastYear ? year-1 : year, m, d, secs);
+
+    return t<0 ? 0 : t;
+}
+
+// Local time to seconds since the epoch. The offset from UTC is only looked up when the hour differs from the last.
+qint64 LogTime::fromLocal(int y, int m, int d, int secs)
+{
+    qint64 local=toDays(y, m, d)*SECS_PER_DAY+secs;
+
+    if(local/SECS_PER_HOUR!=hour)
+    {
+        struct tm tm;
+
+        memset(&tm, 0, sizeof(struct tm));
+        tm.tm_year=y-1900;
+        tm.tm_mon=m;
+        tm.tm_mday=d;
+        tm.tm_hour=secs/SECS_PER_HOUR;
+        tm.tm_isdst=-1;
+        hour=local/SECS_PER_HOUR;
+        offset=hour*SECS_PER_HOUR-mktime(&tm);
+    }
+    return local-offset;
+}
+
+void LogTime::setYear(qint64 now)
+{
+    time_t    current=(time_t)now;
+    struct tm tm;
+
+    localtime_r(&current, &tm);
+    year=tm.tm_year+1900;
+    nowOffset=tm.tm_gmtoff;
+    yearStart=fromLocal(year, 0, 1, 0);
+    yearEnd=fromLocal(year+1, 0, 1, 0);
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef UFW_LOG_TIME_H
+#define UFW_LOG_TIME_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logentry.h"
+
+namespace UFW
+{
+
+//
+// Converts syslog timestamps to seconds since the epoch - both BSD ("Apr  6 11:42:41") and RFC 5424/ISO 8601
+// ("2011-04-06T11:42:41.123456+01:00") timestamps. The date is converted arithmetically, without allocating memory.
+// Only the offset of local time from UTC needs the C library - this is looked up once per hour of the timestamps
+// converted, and log lines arrive in order, so most lines need no look up. As the looked up values are kept, each
+// object should only be used by one thread at a time.
+class LogTime
+{
+    public:
+
+    LogTime() : yearStart(0), yearEnd(0), year(0), nowOffset(0), hour(-1), offset(0) { }
+
+    // Returns 0 if the timestamp cannot be parsed. BSD timestamps have no year, so this is the last year in which the
+    // time is not after 'now' (allowing a day for clock differences) - i.e. entries from December, read in January,
+    // are from last year.
+    qint64 toTime(const LogField &timestamp, qint64 now);
+
+    private:
+
+    qint64 fromLocal(int y, int m, int d, int secs);
+    void   setYear(qint64 now);
+
+    private:
+
+    qint64 yearStart,  // Local start of the current year, and the next - the year is only looked up again once
+           yearEnd;    // 'now' is outside of these
+    int    year;
+    qint64 nowOffset;  // Offset of local time from UTC in the current year
+    qint64 hour,       // Local time, in hours since the epoch, last looked up - and its offset from UTC
+           offset;
+};
+
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "wire.h"
+#include <QtCore/QDataStream>
+
+namespace UFW
+{
+
+namespace Wire
+{
+
+const char * const policies[]  = { "allow", "deny", "reject", "limit", 0L };
+const char * const logLevels[] = { "off", "low", "medium", "high", "full", 0L };
+const char * const protocols[] = { "any", "tcp", "udp", 0L };
+const char * const loggings[]  = { "", "log", "log-all", 0L };
+
+quint8 toCode(const char * const *codes, const QString &str)
+{
+    for(quint8 i=0; codes[i]; ++i)
+        if(str==QLatin1String(codes[i]))
+            return i;
+    return 0;
+}
+
+quint32 Encoder::string(const QString &str)
+{
+    QHash<QString, quint32>::ConstIterator it=index.constFind(str);
+
+    if(it!=index.constEnd())
+        return it.value();
+
+    quint32 idx=strings.size();
+    strings.append(str);
+    index.insert(str, idx);
+    return idx;
+}
+
+QByteArray Encoder::data() const
+{
+    QByteArray  table,
+                data;
+    QDataStream tableStream(&table, QIODevice::WriteOnly),
+                stream(&data, QIODevice::WriteOnly);
+
+    tableStream << (quint32)strings.size();
+    QVector<QString>::ConstIterator sIt(strings.constBegin()),
+                                    sEnd(strings.constEnd());
+    for(; sIt!=sEnd; ++sIt)
+        tableStream << (*sIt).toUtf8();
+
+    stream << (quint32)MAGIC << (quint8)VERSION;
+    stream << (quint8)SECTION_STRINGS << table;
+
+    QMap<quint8, QByteArray>::ConstIterator it(sections.constBegin()),
+                                            end(sections.constEnd());
+    for(; it!=end; ++it)
+        stream << it.key() << it.value(); // QByteArray is written as quint32 length + bytes
+    return data;
+}
+
+Decoder::Decoder(const QByteArray &data)
+       : valid(false)
+{
+    QDataStream stream(data);
+    quint32     magic=0;
+    quint8      version=0;
+
+    stream >> magic >> version;
+    if(MAGIC!=magic || VERSION!=version)
+        return;
+
+    while(!stream.atEnd())
+    {
+        quint8     section;
+        QByteArray payload;
+
+        stream >> section >> payload;
+        if(QDataStream::Ok!=stream.status())
+            return;
+        sections.insert(section, payload);
+    }
+
+    if(sections.contains(SECTION_STRINGS))
+    {
+        QByteArray  table=sections.take(SECTION_STRINGS);
+        QDataStream tableStream(table);
+        quint32     count=0;
+
+        tableStream >> count;
+        strings.reserve(qMin(count, (quint32)table.size()));
+        for(quint32 i=0; i<count && QDataStream::Ok==tableStream.status(); ++i)
+        {
+            QByteArray str;
+            tableStream >> str;
+            strings.append(QString::fromUtf8(str.constData(), str.size()));
+        }
+        if(QDataStream::Ok!=tableStream.status())
+            return;
+    }
+
+    valid=true;
+}
+
+}
+
+}
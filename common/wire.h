@@ -0,0 +1,125 @@
+#ifndef UFW_WIRE_H
+#define UFW_WIRE_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+//
+// Binary encoding of the firewall state, as sent from the helper to the KCM. This is written with QDataStream:
+//
+//   quint32 magic, quint8 version
+//   { quint8 section, quint32 length, <length bytes> } ...
+//
+// Unknown sections are skipped, so new sections may be added without changing the version. The strings section
+// always comes first - other sections refer to strings by their index within this.
+//
+//   SECTION_STRINGS  - quint32 count, { QByteArray utf8 } ...
+//   SECTION_STATUS   - quint8 enabled
+//   SECTION_DEFAULTS - quint8 incoming policy, quint8 outgoing policy, quint8 log level, quint8 ipv6
+//   SECTION_RULES    - quint32 count, { quint8 action, quint8 flags, quint8 protocol, quint8 logging,
+//                                       quint32 dapp, sapp, dport, sport, dst, src, interface in, interface out } ...
+//   SECTION_MODULES  - quint32 count, { quint32 module } ...
+//
+// Policies, log levels, protocols, and logging are sent as their index in the code tables below - these are in the
+// same order as the Types enums. 'Any' addresses and ports are sent as empty strings.
+namespace UFW
+{
+
+namespace Wire
+{
+
+enum Constants
+{
+    MAGIC   = 0x55465742, // 'UFWB'
+    VERSION = 1
+};
+
+enum Section
+{
+    SECTION_STRINGS  = 1,
+    SECTION_STATUS   = 2,
+    SECTION_DEFAULTS = 3,
+    SECTION_RULES    = 4,
+    SECTION_MODULES  = 5
+};
+
+enum RuleFlags
+{
+    RULE_INCOMING = 0x01,
+    RULE_V6       = 0x02
+};
+
+// Code tables - null terminated
+extern const char * const policies[];  // Types::Policy
+extern const char * const logLevels[]; // Types::LogLevel
+extern const char * const protocols[]; // Types::Protocol
+extern const char * const loggings[];  // Types::Logging
+
+// Index of str within codes, or 0 if not found
+extern quint8 toCode(const char * const *codes, const QString &str);
+
+class Encoder
+{
+    public:
+
+    quint32    string(const QString &str);
+    void       addSection(Section section, const QByteArray &payload) { sections.insert(section, payload); }
+    QByteArray data() const;
+
+    private:
+
+    QHash<QString, quint32>  index;
+    QVector<QString>         strings;
+    QMap<quint8, QByteArray> sections;
+};
+
+class Decoder
+{
+    public:
+
+    Decoder(const QByteArray &data);
+
+    bool            isValid() const                { return valid; }
+    bool            hasSection(Section section) const { return sections.contains(section); }
+    QByteArray      section(Section section) const { return sections[section]; }
+    const QString & string(quint32 idx) const      { return idx<(quint32)strings.size() ? strings[idx] : empty; }
+
+    private:
+
+    bool                     valid;
+    QVector<QString>         strings;
+    QMap<quint8, QByteArray> sections;
+    QString                  empty;
+};
+
+}
+
+}
+
+#endif
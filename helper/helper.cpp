@@ -22,17 +22,34 @@
  */
 
 #include "helper.h"
+#include "state.h"
+#include "logentry.h"
+#include "logtime.h"
+#include "logindex.h"
 #include "config.h"
 #include <QtCore/QDebug>
 #include <QtCore/QByteArray>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QProcess>
 #include <QtCore/QProcessEnvironment>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 #include <QtCore/QTextCodec>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QtEndian>
+#include <QtCore/QThread>
+#include <QtCore/QtConcurrentMap>
+#include <QtNetwork/QLocalSocket>
+#include <kfilterdev.h>
+#include <limits.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
 
 namespace UFW
 {
@@ -42,6 +59,30 @@ namespace UFW
 #define KCM_UFW_DIR       "/etc/kcm_ufw"
 #define PROFILE_EXTENSION ".ufw"
 #define LOG_FILE          "/var/log/ufw.log"
+#define STATS_FILE        "/var/lib/kcm_ufw/stats"
+#define STATS_DATA_FILE   "/var/lib/kcm_ufw/stats.dat" // Histograms, kept across instances of the helper
+#define PY_HELPER         HELPER_DIR "/kcm_ufw_helper.py"
+
+// Keep in sync with kcm_ufw_helper.py
+#define DAEMON_SOCKET     "/var/run/kcm_ufw_helper.socket"
+
+#define DAEMON_CONNECT_TIMEOUT 1000  // ms
+#define DAEMON_START_WAIT      100   // ms
+#define DAEMON_START_TRIES     50
+#define DAEMON_REPLY_TIMEOUT   30000 // ms - same as QProcess::waitForFinished()
+#define REQUEST_BUFFER_SIZE    65536 // Bytes of a request to buffer before waiting for the helper to read them
+
+#define LOG_BLOCK_SIZE         (256*1024) // Bytes of the log to read at a time
+#define PARALLEL_SCAN_SIZE     (16*1024*1024) // Bytes - larger parts of a log are scanned in parallel chunks
+#define PARALLEL_CHUNKS        4 // Chunks per thread - so that threads finishing early can take another
+
+#define REPLY_CHUNK_SIZE       (4*1024*1024) // Bytes of log lines per message - larger replies are sent in chunks
+#define FOLLOW_PUSH_INTERVAL   100 // ms - new log lines are pushed to the client at most this often
+#define FOLLOW_MAX_LINES       500 // Lines per push - any more are left in the log until the next push
+#define FOLLOW_POLL_INTERVAL   250 // ms - how often to check whether the client has stopped following the log
+
+#define MARSHAL_SAMPLE_INTERVAL 32 // Replies of a command per measurement of the time taken to marshal them
+#define STATS_SAVE_INTERVAL     16 // Commands recorded between saves of the statistics
 
 static void setPermissions(const QString &f, int perms)
 {
@@ -64,57 +105,645 @@ static void checkFolder()
     }
 }
 
-ActionReply Helper::query(const QVariantMap &args)
+static bool connectToDaemon(QLocalSocket &socket)
 {
-    qDebug() << __FUNCTION__;
-    ActionReply reply=args["defaults"].toBool()
-                        ? run(QStringList() << "--status" << "--defaults" << "--list" << "--modules", "query")
-                        : run(QStringList() << "--status" << "--list", "query");
-
-    if(args["profiles"].toBool()) {
-        QDir dir(KCM_UFW_DIR);
-        QStringList profiles=dir.entryList(QStringList() << "*"PROFILE_EXTENSION);
-        QMap<QString, QVariant> data;
-        foreach (const QString &profile, profiles) {
-            QFile f(dir.canonicalPath()+QChar('/')+profile);
-            if (f.open(QIODevice::ReadOnly)) {
-                data.insert(profile, f.readAll());
+    socket.connectToServer(DAEMON_SOCKET);
+    if(socket.waitForConnected(DAEMON_CONNECT_TIMEOUT))
+        return true;
+
+    // Daemon is not running (or it has timed out) - so start a new instance, and wait for it to listen...
+    if(!QProcess::startDetached(PY_HELPER, QStringList() << "--daemon"))
+        return false;
+
+    for(int i=0; i<DAEMON_START_TRIES; ++i)
+    {
+        ::usleep(DAEMON_START_WAIT*1000);
+        socket.connectToServer(DAEMON_SOCKET);
+        if(socket.waitForConnected(DAEMON_CONNECT_TIMEOUT))
+            return true;
+    }
+    return false;
+}
+
+static void appendFrame(QByteArray &data, const QByteArray &frame)
+{
+    uchar size[4];
+
+    qToBigEndian<quint32>(frame.size(), size);
+    data.append((const char *)size, 4);
+    data.append(frame);
+}
+
+static bool readBytes(QIODevice &dev, qint64 size, QByteArray &data)
+{
+    data.clear();
+    while(data.size()<size)
+    {
+        if(0==dev.bytesAvailable() && !dev.waitForReadyRead(DAEMON_REPLY_TIMEOUT))
+            return false;
+        data.append(dev.read(size-data.size()));
+    }
+    return true;
+}
+
+static bool flush(QIODevice &dev, qint64 maxPending)
+{
+    while(dev.bytesToWrite()>maxPending)
+        if(!dev.waitForBytesWritten(DAEMON_REPLY_TIMEOUT))
+            return false;
+    return true;
+}
+
+// Send the arguments to the python helper. The request is a list of frames (32-bit big-endian length, followed by
+// the UTF-8 argument), terminated by an empty frame. Frames are written as they are encoded, and only
+// REQUEST_BUFFER_SIZE bytes are buffered - the helper applies each option as it is received.
+static bool writeRequest(QIODevice &dev, const QStringList &args)
+{
+    QStringList::ConstIterator it(args.constBegin()),
+                               end(args.constEnd());
+
+    for(; it!=end; ++it)
+    {
+        QByteArray frame;
+
+        appendFrame(frame, (*it).toUtf8());
+        if(dev.write(frame)!=frame.size() || !flush(dev, REQUEST_BUFFER_SIZE))
+            return false;
+    }
+
+    QByteArray frame;
+
+    appendFrame(frame, QByteArray());
+    return dev.write(frame)==frame.size() && flush(dev, 0);
+}
+
+// The reply is a 32-bit exit code, a frame containing the output, and then the microseconds spent in the UFW backend
+// and in reloading the firewall - as 64-bit big-endian values.
+static bool readReply(QIODevice &dev, int &exitCode, QByteArray &response, Stats::Timings &timings)
+{
+    QByteArray header,
+               trailer;
+
+    if(!readBytes(dev, 8, header) ||
+       !readBytes(dev, qFromBigEndian<quint32>((const uchar *)header.constData()+4), response))
+        return false;
+
+    exitCode=qFromBigEndian<qint32>((const uchar *)header.constData());
+    if(readBytes(dev, 16, trailer))
+    {
+        quint64 reload=qFromBigEndian<quint64>((const uchar *)trailer.constData()+8);
+
+        timings.add(Stats::PHASE_BACKEND, qFromBigEndian<quint64>((const uchar *)trailer.constData()));
+        if(reload)
+            timings.add(Stats::PHASE_RELOAD, reload);
+    }
+    return true;
+}
+
+// UFW log lines, as sent to the client - each line (including its newline) is appended to 'data'. If 'stream' is set,
+// then once REPLY_CHUNK_SIZE bytes are held these are sent to the client (via progressStep), so that no one message
+// exceeds the bus' limit - only the rest are then sent in the reply. If 'since' is set, then only lines from that
+// time (and until 'until', if set) are kept.
+struct LogLines
+{
+    LogLines(bool s=false)
+        : count(0), newest(0), skip(0), fromStart(true), stream(s), since(0), until(0), now(::time(0L)) { }
+
+    void append(const char *line, int length);
+    void append(const QByteArray &line)            { append(line.constData(), line.size()); }
+    void flush();
+
+    QByteArray data;
+    int        count,
+               newest,    // If set, only the newest lines, of those after the offset, are read
+               skip;      // Lines to count, but not keep, before any are kept
+    bool       fromStart, // Set if every log was read from its start - i.e. no lines were skipped
+               stream;
+    qint64     since,
+               until,
+               now;
+    LogTime    logTime;
+};
+
+void LogLines::append(const char *line, int length)
+{
+    if(since)
+    {
+        LogEntry entry;
+
+        if(!entry.parse(line, length))
+            return;
+
+        qint64 t=logTime.toTime(entry.timestamp, now);
+
+        if(t<since || (until && t>until))
+            return;
+    }
+
+    if(++count<=skip)
+        return;
+    data.append(line, length);
+    if(length && '\n'!=line[length-1])
+        data.append('\n');
+    if(stream && data.size()>=REPLY_CHUNK_SIZE)
+        flush();
+}
+
+void LogLines::flush()
+{
+    if(data.isEmpty())
+        return;
+
+    QVariantMap chunk;
+
+    chunk["log"]=data;
+    HelperSupport::progressStep(chunk);
+    data.clear();
+}
+
+static quint64 fileInode(QFile &file)
+{
+    struct stat info;
+
+    return 0==fstat(file.handle(), &info) ? (quint64)info.st_ino : 0;
+}
+
+// Scan the log from the device's current position, and append the UFW lines to 'lines'. The log is read in blocks,
+// which are searched for the UFW marker - so only the matching lines are copied. Only complete lines are read, unless
+// 'partial' is set - in which case a final line without a newline is also read. If maxLines is non-zero, then reading
+// stops once 'lines' has this many entries - and 'more' is set. If 'index' is set, and the scan starts within the part
+// of the log already indexed, then the index is extended with the lines read. If 'lines' is not set, the log is only
+// indexed. Returns the number of bytes consumed.
+static qint64 scanLog(QIODevice &dev, LogLines *lines, int maxLines, bool partial, bool &more, LogIndex *index=0L)
+{
+    QByteArray block;
+    qint64     base=dev.pos(),
+               consumed=0;
+    int        carried=0; // Bytes of an incomplete line, carried over from the previous block
+
+    more=false;
+    if(index && base>index->indexedTo())
+        index=0L;
+    for(;;)
+    {
+        block.resize(carried+LOG_BLOCK_SIZE);
+
+        qint64     got=dev.read(block.data()+carried, LOG_BLOCK_SIZE);
+        bool       eof=got<=0;
+        int        size=carried+(eof ? 0 : got);
+        const char *data=block.constData(),
+                   *end=data+size,
+                   *lastEol=(const char *)memrchr(data, '\n', size),
+                   *scanEnd=eof && partial ? end : (lastEol ? lastEol+1 : data),
+                   *pos=data,
+                   *marker;
+
+        while(pos<scanEnd && 0L!=(marker=LogEntry::findMarker(pos, scanEnd-pos)))
+        {
+            const char *start=(const char *)memrchr(pos, '\n', marker-pos),
+                       *eol=(const char *)memchr(marker, '\n', scanEnd-marker);
+
+            start=start ? start+1 : pos;
+            eol=eol ? eol+1 : scanEnd;
+            if(lines && maxLines && lines->count>=maxLines)
+            {
+                more=true;
+                consumed+=start-data;
+                if(index)
+                    index->setIndexedTo(base+consumed);
+                return consumed;
             }
+
+            if(index)
+                index->add(base+consumed+(start-data), start, eol-start);
+            if(lines)
+                lines->append(start, eol-start);
+            pos=eol;
+        }
+
+        consumed+=scanEnd-data;
+        if(index)
+            index->setIndexedTo(base+consumed);
+        if(eof)
+            return consumed;
+        carried=end-scanEnd;
+        memmove(block.data(), scanEnd, carried);
+    }
+}
+
+// Part of a mapped log, starting after one newline and ending with another - and the UFW lines found within it
+struct LogChunk
+{
+    const char           *start,
+                         *end;
+    QVector<const char*> lines;
+};
+
+static void scanChunk(LogChunk &chunk)
+{
+    const char *pos=chunk.start,
+               *marker;
+
+    while(pos<chunk.end && 0L!=(marker=LogEntry::findMarker(pos, chunk.end-pos)))
+    {
+        const char *start=(const char *)memrchr(pos, '\n', marker-pos),
+                   *eol=(const char *)memchr(marker, '\n', chunk.end-marker);
+
+        start=start ? start+1 : pos;
+        eol=eol ? eol+1 : chunk.end;
+        chunk.lines.append(start);
+        pos=eol;
+    }
+}
+
+// Scan the rest of a plain log, from its current position, as scanLog() - but without a line limit. If this is large,
+// then it is mapped and split into chunks, which are scanned in parallel. The chunks' lines are then copied from the
+// map, and added to the index, in order. Returns the number of bytes consumed.
+static qint64 scanFile(QFile &file, LogLines *lines, LogIndex *index)
+{
+    qint64 base=file.pos(),
+           size=file.size()-base;
+    uchar  *map=size>=PARALLEL_SCAN_SIZE ? file.map(base, size) : 0L;
+    bool   more;
+
+    if(!map)
+        return scanLog(file, lines, 0, false, more, index);
+
+    // Only complete lines are read
+    const char        *data=(const char *)map,
+                      *last=(const char *)memrchr(data, '\n', size),
+                      *end=last ? last+1 : data,
+                      *pos=data;
+    int               count=qMax(1, QThread::idealThreadCount())*PARALLEL_CHUNKS;
+    QVector<LogChunk> chunks;
+
+    for(int i=1; i<=count && pos<end; ++i)
+    {
+        const char *split=data+((end-data)*i/count),
+                   *eol=i<count && split>=pos ? (const char *)memchr(split, '\n', end-split) : 0L;
+        LogChunk   chunk;
+
+        chunk.start=pos;
+        chunk.end=eol ? eol+1 : (i<count ? pos : end);
+        if(chunk.end>chunk.start)
+            chunks.append(chunk);
+        pos=chunk.end;
+    }
+
+    QtConcurrent::blockingMap(chunks, scanChunk);
+
+    QVector<LogChunk>::ConstIterator it(chunks.constBegin()),
+                                     cEnd(chunks.constEnd());
+
+    if(index && base>index->indexedTo())
+        index=0L;
+    for(; it!=cEnd; ++it)
+    {
+        QVector<const char *>::ConstIterator line((*it).lines.constBegin()),
+                                             lEnd((*it).lines.constEnd());
+
+        for(; line!=lEnd; ++line)
+        {
+            int length=(const char *)memchr(*line, '\n', end-*line)+1-*line;
+
+            if(index && index->wants(base+(*line-data)))
+                index->add(base+(*line-data), *line, length);
+            if(lines)
+                lines->append(*line, length);
+        }
+    }
+
+    qint64 consumed=end-data;
+
+    if(index)
+        index->setIndexedTo(base+consumed);
+    file.unmap(map);
+    file.seek(base+consumed);
+    return consumed;
+}
+
+// Offset of the first of the newest 'maxLines' UFW lines after 'from' - or 'from', if there are not that many. The log
+// is read backwards from its end in blocks, and the lines found within each are counted - the start of a line that
+// spans two blocks is carried over to the earlier block. A line still being written, at the end, is not counted.
+static qint64 newestLines(QFile &file, qint64 from, int maxLines)
+{
+    qint64     pos=file.size();
+    QByteArray block,
+               carried;
+    int        count=0;
+    bool       last=true;
+
+    while(pos>from && maxLines>0)
+    {
+        int size=(int)qMin((qint64)LOG_BLOCK_SIZE, pos-from);
+
+        pos-=size;
+        if(!file.seek(pos) || (block=file.read(size)).size()!=size)
+            return from;
+        block+=carried;
+
+        const char *data=block.constData(),
+                   *end=data+block.size(),
+                   *start=data;
+
+        if(last)
+        {
+            const char *eol=(const char *)memrchr(data, '\n', end-data);
+
+            end=eol ? eol+1 : data;
+            last=false;
+        }
+
+        // Unless at 'from', the block starts part way through a line - which is carried over to the next block
+        if(pos>from)
+        {
+            start=(const char *)memchr(data, '\n', end-data);
+            start=start ? start+1 : end;
+        }
+
+        QVector<const char *> found;
+        const char            *p=start,
+                              *marker;
+
+        while(p<end && 0L!=(marker=LogEntry::findMarker(p, end-p)))
+        {
+            const char *lineStart=(const char *)memrchr(p, '\n', marker-p),
+                       *eol=(const char *)memchr(marker, '\n', end-marker);
+
+            found.append(lineStart ? lineStart+1 : p);
+            p=eol ? eol+1 : end;
+        }
+
+        if(count+found.count()>=maxLines)
+            return pos+(found[found.count()-(maxLines-count)]-data);
+        count+=found.count();
+        carried=block.left(start-data);
+    }
+    return from;
+}
+
+// Read the UFW lines from 'offset' onwards. Only complete lines are read, and 'offset' is updated to the end of the
+// last of these - so that a line being written is read in full next time. If the file is now smaller than 'offset', or
+// 'offset' is not at the start of a line, then the file has been truncated (and maybe re-written) - so it is read
+// from the start. If lines.newest is set, then the older lines are skipped. Returns true if maxLines was reached before
+// the end of the file.
+static bool readLines(QFile &file, qint64 &offset, LogLines &lines, int maxLines, LogIndex *index)
+{
+    char prev=0;
+    bool more=false;
+
+    if(offset>file.size() || (offset>0 && (!file.seek(offset-1) || !file.getChar(&prev) || '\n'!=prev)))
+        offset=0;
+    index->validate(file);
+    if(lines.newest)
+        offset=newestLines(file, offset, lines.newest);
+    lines.fromStart=lines.fromStart && 0==offset;
+    if(!file.seek(offset))
+        return false;
+
+    offset+=maxLines ? scanLog(file, &lines, maxLines, false, more, index) : scanFile(file, &lines, index);
+    return more;
+}
+
+// Read the lines written to the log since (inode, offset), and update these to refer to the end of the lines read. If
+// the log has been rotated since, then the rest of the old log is read from its rotated name first. 'more' is set if
+// maxLines was reached before the end of the log. The indexes of the logs are extended with the lines read.
+static bool readLog(const QString &fileName, quint64 &inode, qint64 &offset, LogLines &lines, int maxLines, bool &more,
+                    LogIndexes &indexes)
+{
+    QFile file(fileName);
+
+    more=false;
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    quint64 currentInode=fileInode(file);
+
+    if(0!=inode && inode!=currentInode)
+    {
+        QFile rotated(fileName+".1");
+
+        if(rotated.open(QIODevice::ReadOnly) && fileInode(rotated)==inode &&
+           readLines(rotated, offset, lines, maxLines, indexes.get(rotated)))
+        {
+            more=true;
+            return true;
         }
-        reply.addData("profiles", data);
+        offset=0;
+    }
+    inode=currentInode;
+    more=readLines(file, offset, lines, maxLines, indexes.get(file));
+    return true;
+}
+
+// Rotated copies of the log, newest first - e.g. ufw.log.1, ufw.log.2.gz, ufw.log.3.gz
+static QStringList logArchives(const QString &fileName)
+{
+    QFileInfo                  info(fileName);
+    QDir                       dir(info.absolutePath());
+    QString                    prefix=info.fileName()+'.';
+    QStringList                names=dir.entryList(QStringList() << prefix+'*', QDir::Files);
+    QStringList::ConstIterator it(names.constBegin()),
+                               end(names.constEnd());
+    QMap<int, QString>         archives;
+
+    for(; it!=end; ++it)
+    {
+        QString suffix=(*it).mid(prefix.length());
+        bool    ok=false;
+        int     num=suffix.section('.', 0, 0).toInt(&ok);
+
+        if(ok && num>0)
+            archives.insert(num, dir.absoluteFilePath(*it));
     }
+    return archives.values();
+}
 
+// Open a log, decompressing it (as it is read) if required
+static QIODevice * openLog(const QString &fileName)
+{
+    QIODevice *dev=KFilterDev::deviceForFile(fileName);
+
+    if(dev && !dev->open(QIODevice::ReadOnly))
+    {
+        delete dev;
+        dev=0L;
+    }
+    return dev;
+}
+
+// The first line of a log is used to identify it, as its name changes on each rotation - and its inode when it is
+// compressed.
+static QByteArray firstLine(const QString &fileName)
+{
+    QIODevice  *dev=openLog(fileName);
+    QByteArray line;
+
+    if(dev)
+    {
+        line=dev->readLine();
+        delete dev;
+    }
+    return line;
+}
+
+// Read any pending inotify events, and return whether any of these refer to the log
+static bool logChanged(int fd, const QByteArray &name)
+{
+    char    buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool    changed=false;
+    ssize_t len;
+
+    while((len=::read(fd, buffer, sizeof(buffer)))>0)
+        for(char *ptr=buffer; ptr<buffer+len; )
+        {
+            const struct inotify_event *event=(const struct inotify_event *)ptr;
+
+            if((event->mask&IN_Q_OVERFLOW) || (event->len && name==event->name))
+                changed=true;
+            ptr+=sizeof(struct inotify_event)+event->len;
+        }
+    return changed;
+}
+
+// Convert a single modification into arguments for the python helper. 'fields' is updated with the parts of the
+// firewall state that the modification affects.
+static bool opArgs(const QVariantMap &args, const QString &cmd, QStringList &cmdArgs, int &fields)
+{
+    if("addRules"==cmd)
+    {
+        unsigned int count=args["count"].toUInt();
+
+        if(0==count)
+            return false;
+        for(unsigned int i=0; i<count; ++i)
+            cmdArgs << "--add="+args["xml"+QString().setNum(i)].toString();
+        fields|=State::FIELD_RULES;
+    }
+    else if("removeRule"==cmd)
+    {
+        cmdArgs << "--remove="+args["index"].toString();
+        fields|=State::FIELD_RULES;
+    }
+    else if("moveRule"==cmd)
+    {
+        cmdArgs << "--move="+QString().setNum(args["from"].toUInt())+':'+QString().setNum(args["to"].toUInt());
+        fields|=State::FIELD_RULES;
+    }
+    else if("editRule"==cmd)
+    {
+        cmdArgs << "--update="+args["xml"].toString();
+        fields|=State::FIELD_RULES;
+    }
+    else if("reorder"==cmd)
+    {
+        // order is the new order of all rules, as a list of their current (1-based) positions
+        QVariantList                order=args["order"].toList();
+        QVariantList::ConstIterator it(order.constBegin()),
+                                    end(order.constEnd());
+        QStringList                 positions;
+
+        if(order.isEmpty())
+            return false;
+        for(; it!=end; ++it)
+            positions << QString().setNum((*it).toUInt());
+        cmdArgs << "--reorder="+positions.join(",");
+        fields|=State::FIELD_RULES;
+    }
+    else if("setDefaults"==cmd)
+    {
+        cmdArgs << "--setDefaults="+args["xml"].toString();
+        // Changing IPv6 support may remove rules...
+        fields|=State::FIELD_DEFAULTS|(args["ipv6"].toBool() ? State::FIELD_RULES : 0);
+    }
+    else if("setModules"==cmd)
+    {
+        cmdArgs << "--setModules="+args["xml"].toString();
+        fields|=State::FIELD_MODULES;
+    }
+    else
+        return false;
+    return true;
+}
+
+// The helper exits shortly after its last action, so the statistics of previous instances are read from disk
+Helper::Helper()
+      : stateGeneration(0)
+      , lister(0L)
+      , unsavedTimings(0)
+{
+    statistics.load(STATS_DATA_FILE);
+}
+
+// KAuth quits the helper's event loop once it has been idle for a while - and does not delete the helper
+void Helper::saveStatistics()
+{
+    if(unsavedTimings && statistics.save(STATS_DATA_FILE))
+        unsavedTimings=0;
+}
+
+ActionReply Helper::query(const QVariantMap &args)
+{
+    qDebug() << __FUNCTION__;
+    ActionReply   reply;
+    QElapsedTimer timer;
+
+    timer.start();
+    timings.clear();
+
+    // If the client already has the current generation, then there is no need to send the state again
+    if(args.contains("ifChangedSince") && updateStateCache() && args["ifChangedSince"].toULongLong()==stateGeneration)
+    {
+        reply.addData("notModified", true);
+        reply.addData("cmd", "query");
+    }
+    else
+        reply=readState(args["defaults"].toBool()
+                            ? State::FIELD_ALL
+                            : State::FIELD_STATUS|State::FIELD_RULES, "query");
+
+    if(args["profiles"].toBool())
+        reply.addData("profiles", readProfiles());
+
+    addGeneration(reply);
+    recordTimings(reply, "query", timer);
     return reply;
 }
 
+// The client passes back the inode and offset from the previous reply, and only lines written since then are returned -
+// or, if "maxLines" is set, only the newest of these. If "follow" is set, then new lines continue to be sent (via progressStep) until the client stops the action. If
+// "since" is set, then only the lines from that time (and until "until", if set) are returned.
 ActionReply Helper::viewlog(const QVariantMap &args)
 {
     qDebug() << __FUNCTION__;
 
-    QString     lastLine=args["lastLine"].toString(),
-                logFile=args["logFile"].toString();
-    QFile       file(logFile.isEmpty() ? QLatin1String(LOG_FILE) : logFile);
+    QString     logFile=args["logFile"].toString(),
+                fileName=logFile.isEmpty() ? QLatin1String(LOG_FILE) : logFile;
+    quint64     inode=args["inode"].toULongLong();
+    qint64      offset=args["offset"].toLongLong();
     ActionReply reply;
 
-    if(file.open(QIODevice::ReadOnly|QIODevice::Text))
-    {
-        QStringList lines;
-        while (!file.atEnd())
-        {
-            QString line(file.readLine());
+    if(args["follow"].toBool())
+        return followLog(fileName, inode, offset);
+    if(args.contains("olderThan"))
+        return readHistory(fileName, args["olderThan"].toByteArray(), args["maxLines"].toInt());
+    if(args.contains("since"))
+        return readWindow(fileName, args["since"].toLongLong(), args["until"].toLongLong(), args["maxLines"].toInt());
 
-            if(line.contains(" [UFW "))
-            {
-                if(!lastLine.isEmpty() && line==lastLine)
-                {
-                    lines.clear();
-                    continue;
-                }
-                lines.append(line);
-            }
-        }
+    // Only the newest lines that the client can list are read, and these are sent in chunks
+    LogLines   lines(true);
+    LogIndexes indexes(fileName);
+    bool       more;
 
-        reply.addData("lines", lines);
+    lines.newest=args["maxLines"].toInt();
+    if(readLog(fileName, inode, offset, lines, 0, more, indexes))
+    {
+        reply.addData("log", lines.data);
+        reply.addData("inode", inode);
+        reply.addData("offset", offset);
+        // Older entries can only be loaded if the client has all of the current log
+        if(lines.fromStart)
+            reply.addData("firstLine", firstLine(fileName));
     }
     else
     {
@@ -125,76 +754,342 @@ ActionReply Helper::viewlog(const QVariantMap &args)
     return reply;
 }
 
+// Read the UFW lines of a rotated log - the first line of the log is read, and returned, separately
+static void readArchive(QIODevice &dev, LogLines &lines, QByteArray &first)
+{
+    bool more;
+
+    first=dev.readLine();
+    if(LogEntry::findMarker(first.constData(), first.size()))
+        lines.append(first);
+    scanLog(dev, &lines, 0, true, more);
+}
+
+// Older log entries are read one rotated log at a time - the client passes the first line of the oldest log it has,
+// and the UFW lines of the log rotated before that are returned. Compressed logs are decompressed as they are read,
+// and only their UFW lines are kept. If maxLines is set, then only the newest maxLines lines are returned - as the log
+// may be compressed, it is read twice: once to count its lines, and then to skip the older of these. The lines are
+// sent in chunks.
+ActionReply Helper::readHistory(const QString &fileName, const QByteArray &olderThan, int maxLines)
+{
+    QStringList files=QStringList() << fileName << logArchives(fileName);
+    int         index=0;
+    ActionReply reply;
+
+    if(!olderThan.isEmpty())
+        for(index=0; index<files.count() && firstLine(files[index])!=olderThan; ++index)
+            ;
+
+    LogLines   lines(true);
+    QByteArray first;
+    QIODevice  *dev=++index<files.count() ? openLog(files[index]) : 0L;
+
+    if(dev && maxLines>0)
+    {
+        LogLines counted;
+
+        counted.skip=INT_MAX;
+        readArchive(*dev, counted, first);
+        delete dev;
+        lines.skip=qMax(0, counted.count-maxLines);
+        dev=openLog(files[index]);
+    }
+
+    if(dev)
+    {
+        readArchive(*dev, lines, first);
+        delete dev;
+    }
+
+    reply.addData("history", true);
+    reply.addData("log", lines.data);
+    reply.addData("firstLine", first);
+    // Older logs are not listed if lines of this one were skipped
+    reply.addData("more", index+1<files.count() && 0==lines.skip);
+    return reply;
+}
+
+// Bring a log's index up to date, and return where to start reading the lines of a time window from - i.e. the last
+// indexed line before 'since'. If maxLines is set, and there are more lines than this after that, then the older lines
+// are skipped - and 'skipped' is set.
+static qint64 windowStart(QFile &file, LogIndex *index, qint64 since, int maxLines, bool &skipped)
+{
+    index->validate(file);
+    if(index->indexedTo()<file.size() && file.seek(index->indexedTo()))
+        scanFile(file, 0L, index);
+
+    qint64 start=index->find(since),
+           newest=maxLines ? newestLines(file, start, maxLines) : start;
+
+    skipped=newest>start;
+    return newest;
+}
+
+// The lines of the log, and its rotated copy, written within a time window. Each log's index is first brought up to
+// date, and then the log is read from the last indexed line before the start of the window - so only the end of a
+// large log needs to be read. The rotated copy is only read if the window starts before the log does. If maxLines is
+// set, and there is no end to the window, then only the newest maxLines lines of each log are read. The lines are sent
+// in chunks, oldest first.
+ActionReply Helper::readWindow(const QString &fileName, qint64 since, qint64 until, int maxLines)
+{
+    QFile       file(fileName),
+                rotated(fileName+".1");
+    LogIndexes  indexes(fileName);
+    LogLines    lines(true);
+    ActionReply reply;
+
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        reply=ActionReply::HelperErrorReply;
+        reply.setErrorCode(STATUS_OPERATION_FAILED);
+        return reply;
+    }
+
+    quint64  inode=fileInode(file);
+    LogIndex *index=indexes.get(file);
+    bool     skipped;
+    qint64   start=windowStart(file, index, since, until ? 0 : maxLines, skipped),
+             offset=start;
+
+    lines.since=since;
+    lines.until=until;
+
+    // The rotated copy is not needed if the window starts within the log, or the log has enough lines
+    if(!skipped && (!index->firstTime() || index->firstTime()>since) && rotated.open(QIODevice::ReadOnly))
+    {
+        LogIndex *rotatedIndex=indexes.get(rotated);
+
+        if(rotated.seek(windowStart(rotated, rotatedIndex, since, until ? 0 : maxLines, skipped)))
+            scanFile(rotated, &lines, rotatedIndex);
+    }
+
+    if(file.seek(start))
+        offset+=scanFile(file, &lines, index);
+
+    reply.addData("window", true);
+    reply.addData("log", lines.data);
+    reply.addData("inode", inode);
+    reply.addData("offset", offset);
+    return reply;
+}
+
+// Watch the log's folder with inotify, and push new lines to the client as they are written. Pushes are sent at most
+// every FOLLOW_PUSH_INTERVAL ms, with at most FOLLOW_MAX_LINES lines - if more have been written, then these are left
+// in the log until the next push. So, a flood of log entries is read no faster than the client is sent them. The final
+// position is returned when the client stops the action.
+ActionReply Helper::followLog(const QString &fileName, quint64 inode, qint64 offset)
+{
+    QByteArray    name=QFile::encodeName(QFileInfo(fileName).fileName());
+    int           fd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    bool          dirty=true;
+    QElapsedTimer lastPush;
+    LogIndexes    indexes(fileName);
+
+    // If inotify is unavailable, just check the log each poll interval
+    if(fd>=0 && inotify_add_watch(fd, QFile::encodeName(QFileInfo(fileName).absolutePath()).constData(),
+                                  IN_MODIFY|IN_CREATE|IN_MOVED_TO|IN_DELETE)<0)
+    {
+        ::close(fd);
+        fd=-1;
+    }
+
+    while(!HelperSupport::isStopped())
+    {
+        int wait=FOLLOW_POLL_INTERVAL;
+
+        // Lines are waiting to be sent, so only wait until the next push is due
+        if(dirty)
+            wait=lastPush.isValid()
+                    ? qBound((qint64)0, FOLLOW_PUSH_INTERVAL-lastPush.elapsed(), (qint64)FOLLOW_POLL_INTERVAL)
+                    : 0;
+
+        if(fd<0)
+        {
+            ::usleep(wait*1000);
+            dirty=true;
+        }
+        else
+        {
+            struct pollfd pfd;
+
+            pfd.fd=fd;
+            pfd.events=POLLIN;
+            pfd.revents=0;
+            if(::poll(&pfd, 1, wait)>0 && logChanged(fd, name))
+                dirty=true;
+        }
+
+        if(dirty && (!lastPush.isValid() || lastPush.elapsed()>=FOLLOW_PUSH_INTERVAL))
+        {
+            LogLines lines;
+            bool     more;
+
+            if(!readLog(fileName, inode, offset, lines, FOLLOW_MAX_LINES, more, indexes))
+                more=false; // Log not there whilst being rotated - wait for it to be created
+            dirty=more;
+            if(lines.count)
+            {
+                QVariantMap data;
+
+                data["log"]=lines.data;
+                data["inode"]=inode;
+                data["offset"]=offset;
+                HelperSupport::progressStep(data);
+                lastPush.start();
+            }
+        }
+    }
+
+    if(fd>=0)
+        ::close(fd);
+
+    ActionReply reply;
+
+    reply.addData("log", QByteArray());
+    reply.addData("inode", inode);
+    reply.addData("offset", offset);
+    return reply;
+}
+
 ActionReply Helper::modify(const QVariantMap &args)
 {
     qDebug() << __FUNCTION__;
     QString cmd=args["cmd"].toString();
 
-    // QProcess converts its args using QString().toLocal8Bit()!!!, so use UTF-8 codec!!!
+    // Profiles are written with QTextStream, which uses the locale's codec!!!, so use UTF-8 codec!!!
     QTextCodec::setCodecForLocale(QTextCodec::codecForName("UTF-8"));
 
+    ActionReply   reply;
+    QElapsedTimer timer;
+
+    timer.start();
+    timings.clear();
+
     if("setStatus"==cmd)
-        return setStatus(args, cmd);
-    else if("addRules"==cmd)
-        return addRules(args, cmd);
-    else if("removeRule"==cmd)
-        return removeRule(args, cmd);
-    else if("moveRule"==cmd)
-        return moveRule(args, cmd);
-    else if("editRule"==cmd)
-        return editRule(args, cmd);
+        reply=setStatus(args, cmd);
+    else if("addRules"==cmd || "removeRule"==cmd || "moveRule"==cmd || "editRule"==cmd || "reorder"==cmd ||
+            "setDefaults"==cmd || "setModules"==cmd)
+        reply=runOp(args, cmd);
 //     else if("editRuleDescr"==cmd)
-//         return editRuleDescr(args, cmd);
+//         reply=editRuleDescr(args, cmd);
+    else if("batch"==cmd)
+        reply=batch(args, cmd);
     else if("reset"==cmd)
-        return reset(cmd);
-    else if("setDefaults"==cmd)
-        return setDefaults(args, cmd);
-    else if("setModules"==cmd)
-        return setModules(args, cmd);
+        reply=reset(cmd);
     else if("setProfile"==cmd)
-        return setProfile(args, cmd);
+        reply=setProfile(args, cmd);
     else if("saveProfile"==cmd)
-        return saveProfile(args, cmd);
+        reply=saveProfile(args, cmd);
     else if("deleteProfile"==cmd)
-        return deleteProfile(args, cmd);
+        reply=deleteProfile(args, cmd);
+    else
+    {
+        reply=ActionReply::HelperErrorReply;
+        reply.setErrorCode(STATUS_INVALID_CMD);
+    }
 
-    ActionReply reply=ActionReply::HelperErrorReply;
-    reply.setErrorCode(STATUS_INVALID_CMD);
+    addGeneration(reply);
+    if(STATUS_INVALID_CMD!=reply.errorCode())
+        recordTimings(reply, cmd, timer);
     return reply;
 }
 
-ActionReply Helper::setStatus(const QVariantMap &args, const QString &cmd)
+// Latency statistics for each command. Reading these does not require authentication.
+ActionReply Helper::stats(const QVariantMap &)
 {
-    return run(QStringList() << "--setEnabled="+QString(args["status"].toBool() ? "true" : "false"),
-               QStringList() << "--status", cmd);
+    qDebug() << __FUNCTION__;
+
+    ActionReply reply;
+
+    reply.addData("stats", statistics.toVariant());
+    reply.addData("text", statistics.toText());
+    return reply;
+}
+
+// Write the statistics to STATS_FILE if "dump" is set, and then clear them if "reset" is set. As these change files
+// owned by root, this is a separate action - which requires authentication.
+ActionReply Helper::managestats(const QVariantMap &args)
+{
+    qDebug() << __FUNCTION__;
+
+    ActionReply reply;
+
+    if(args["dump"].toBool())
+    {
+        QByteArray text=statistics.toText();
+        QFile      f(STATS_FILE);
+
+        QDir().mkpath(QFileInfo(f).absolutePath());
+        if(f.open(QIODevice::WriteOnly))
+        {
+            f.write(text);
+            f.close();
+            setPermissions(f.fileName(), FILE_PERMS);
+        }
+        else
+        {
+            reply=ActionReply::HelperErrorReply;
+            reply.setErrorCode(STATUS_OPERATION_FAILED);
+        }
+    }
+
+    if(args["reset"].toBool())
+    {
+        statistics.clear();
+        unsavedTimings=0;
+        QFile::remove(STATS_DATA_FILE);
+    }
+    return reply;
 }
 
-ActionReply Helper::setDefaults(const QVariantMap &args, const QString &cmd)
+// Record the phase times of the command just run. KAuth marshals the reply after this returns, so the time for this
+// can only be measured by serialising the reply here - which would double the cost of marshalling. Therefore, this is
+// only sampled, for one in every MARSHAL_SAMPLE_INTERVAL replies of each command, and is not part of the total.
+void Helper::recordTimings(const ActionReply &reply, const QString &cmd, const QElapsedTimer &timer)
 {
-    QStringList query;
+    timings.add(Stats::PHASE_TOTAL, timer);
+    if(0==statistics.count(cmd)%MARSHAL_SAMPLE_INTERVAL)
+    {
+        QElapsedTimer marshal;
 
-    query << "--defaults";
-    if (args["ipv6"].toBool())
-        query << "--list";
-    return run(QStringList() << "--setDefaults="+args["xml"].toString(),
-               query, cmd);
+        marshal.start();
+        reply.serialized();
+        timings.add(Stats::PHASE_MARSHAL, marshal);
+    }
+    statistics.record(cmd, timings);
+
+    // Saving is not timed, but the disk I/O would still delay the next command - so only save every few commands, and
+    // when the helper exits. The application does not yet exist when the helper is constructed, so connect here.
+    if(1==++unsavedTimings)
+        connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), SLOT(saveStatistics()), Qt::UniqueConnection);
+    else if(unsavedTimings>=STATS_SAVE_INTERVAL)
+        saveStatistics();
 }
 
-ActionReply Helper::setModules(const QVariantMap &args, const QString &cmd)
+// Every query and modify reply carries the ruleset generation that it refers to
+void Helper::addGeneration(ActionReply &reply)
 {
-    return run(QStringList() << "--setModules="+args["xml"].toString(),
-               QStringList() << "--modules", cmd);
+    if(!reply.data().contains("generation") && updateStateCache())
+        reply.addData("generation", stateGeneration);
+}
+
+ActionReply Helper::setStatus(const QVariantMap &args, const QString &cmd)
+{
+    return run(QStringList() << "--setEnabled="+QString(args["status"].toBool() ? "true" : "false"),
+               State::FIELD_STATUS, cmd);
 }
 
 ActionReply Helper::setProfile(const QVariantMap &args, const QString &cmd)
 {
     QStringList cmdArgs;
 
+    // Apply all changes as one batch, and replace the rules in bulk - rather than removing and adding each
+    // individually, with a rewrite of the rules files for each.
     if(args.contains("ruleCount"))
     {
         unsigned int count=args["ruleCount"].toUInt();
 
-        cmdArgs << "--clearRules";
+        cmdArgs << "--replaceRules";
         for(unsigned int i=0; i<count; ++i)
             cmdArgs << "--add="+args["rule"+QString().setNum(i)].toString();
     }
@@ -213,8 +1108,7 @@ ActionReply Helper::setProfile(const QVariantMap &args, const QString &cmd)
     else
     {
         checkFolder();
-        return run(cmdArgs,
-                   QStringList() << "--status" << "--defaults" << "--list" << "--modules", cmd);
+        return run(QStringList() << "--batch" << cmdArgs, State::FIELD_ALL, cmd);
     }
 }
 
@@ -280,45 +1174,58 @@ ActionReply Helper::deleteProfile(const QVariantMap &args, const QString &cmd)
     return reply;
 }
 
-ActionReply Helper::addRules(const QVariantMap &args, const QString &cmd)
+ActionReply Helper::runOp(const QVariantMap &args, const QString &cmd)
 {
-    unsigned int count=args["count"].toUInt();
+    QStringList cmdArgs;
+    int         fields=0;
 
-    if(count>0)
+    if(!opArgs(args, cmd, cmdArgs, fields))
     {
-        QStringList cmdArgs;
-
-        for(unsigned int i=0; i<count; ++i)
-            cmdArgs << "--add="+args["xml"+QString().setNum(i)].toString();
+        ActionReply reply=ActionReply::HelperErrorReply;
+        reply.setErrorCode(STATUS_INVALID_ARGUMENTS);
+        return reply;
+    }
 
+    if(fields&State::FIELD_RULES)
         checkFolder();
-        return run(cmdArgs, QStringList() << "--list", cmd);
-    }
-    ActionReply reply=ActionReply::HelperErrorReply;
-    reply.setErrorCode(STATUS_INVALID_ARGUMENTS);
-    return reply;
+    return run(cmdArgs, fields, cmd, args["generation"].toULongLong());
 }
 
-ActionReply Helper::removeRule(const QVariantMap &args, const QString &cmd)
+// Apply an ordered list of modifications as a single transaction - the python helper only reloads the firewall once
+// all have been applied, and restores the previous state if any fail.
+ActionReply Helper::batch(const QVariantMap &args, const QString &cmd)
 {
-    checkFolder();
-    return run(QStringList() << "--remove="+args["index"].toString(),
-               QStringList() << "--list", cmd);
-}
+    QVariantList                ops=args["ops"].toList();
+    QVariantList::ConstIterator it(ops.constBegin()),
+                                end(ops.constEnd());
+    QStringList                 cmdArgs;
+    int                         fields=0;
 
-ActionReply Helper::moveRule(const QVariantMap &args, const QString &cmd)
-{
-    checkFolder();
-    return run(QStringList() << "--move="+QString().setNum(args["from"].toUInt())+':'+
-                                          QString().setNum(args["to"].toUInt()),
-               QStringList() << "--list", cmd);
-}
+    cmdArgs << "--batch";
+    for(; it!=end; ++it)
+    {
+        QVariantMap op=(*it).toMap();
 
-ActionReply Helper::editRule(const QVariantMap &args, const QString &cmd)
-{
-    checkFolder();
-    return run(QStringList() << "--update="+args["xml"].toString(),
-               QStringList() << "--list", cmd);
+        if(!opArgs(op, op["cmd"].toString(), cmdArgs, fields))
+        {
+            ActionReply reply=ActionReply::HelperErrorReply;
+            reply.setErrorCode(STATUS_INVALID_ARGUMENTS);
+            reply.addData("cmd", cmd);
+            return reply;
+        }
+    }
+
+    if(0==fields)
+    {
+        ActionReply reply=ActionReply::HelperErrorReply;
+        reply.setErrorCode(STATUS_INVALID_ARGUMENTS);
+        reply.addData("cmd", cmd);
+        return reply;
+    }
+
+    if(fields&State::FIELD_RULES)
+        checkFolder();
+    return run(cmdArgs, fields, cmd, args["generation"].toULongLong());
 }
 
 // ActionReply Helper::editRuleDescr(const QVariantMap &args, const QString &cmd)
@@ -330,42 +1237,226 @@ ActionReply Helper::editRule(const QVariantMap &args, const QString &cmd)
 
 ActionReply Helper::reset(const QString &cmd)
 {
-    return run(QStringList() << "--reset",
-               QStringList() << "--status" << "--defaults" << "--list" << "--modules", cmd);
+    return run(QStringList() << "--reset", State::FIELD_ALL, cmd);
 }
 
-ActionReply Helper::run(const QStringList &args, const QStringList &second, const QString &cmd)
+// If the client states which generation of the rules it has, and this is still current, then only the rules that
+// have changed are returned:
+//   delta["position"] - index of the first changed rule
+//   delta["removed"]  - number of client rules to remove from position
+//   delta["inserted"] - rules to insert at position, encoded as per common/wire.h
+// Rules after these are implicitly renumbered.
+ActionReply Helper::run(const QStringList &args, int fields, const QString &cmd, quint64 clientGeneration)
 {
+    bool               delta=0!=clientGeneration && (fields&State::FIELD_RULES) && updateStateCache() &&
+                             clientGeneration==stateGeneration;
+    QList<State::Rule> before=delta ? state.rules : QList<State::Rule>();
+
     ActionReply reply=run(args, cmd);
-    if(0==reply.errorCode())
-        reply=run(second, cmd);
+    if(0!=reply.errorCode())
+        return reply;
+
+    if(!delta || !updateStateCache())
+        return readState(fields, cmd);
+
+    QElapsedTimer timer;
+
+    timer.start();
+
+    const QList<State::Rule> &b=before,
+                             &a=state.rules;
+    int                      prefix=0,
+                             suffix=0;
+
+    while(prefix<b.count() && prefix<a.count() && b[prefix]==a[prefix])
+        ++prefix;
+    while(suffix<b.count()-prefix && suffix<a.count()-prefix && b[b.count()-1-suffix]==a[a.count()-1-suffix])
+        ++suffix;
+
+    State       inserted;
+    QVariantMap changes;
+
+    inserted.rules=a.mid(prefix, a.count()-prefix-suffix);
+    changes["position"]=prefix;
+    changes["removed"]=b.count()-prefix-suffix;
+    changes["inserted"]=inserted.toWire(State::FIELD_RULES);
+
+    reply=ActionReply();
+    reply.addData("state", state.toWire(fields&~State::FIELD_RULES));
+    reply.addData("delta", changes);
+    reply.addData("baseGeneration", clientGeneration);
+    reply.addData("generation", stateGeneration);
+    reply.addData("cmd", cmd);
+    timings.add(Stats::PHASE_SERIALIZE, timer);
     return reply;
 }
 
+// Read UFW state directly from its files, only falling back to the python helper if this fails. The state is
+// returned in binary form as "state" - the python helper returns XML as "response".
+ActionReply Helper::readState(int fields, const QString &cmd)
+{
+    QElapsedTimer timer;
+
+    timer.start();
+    if(updateStateCache())
+    {
+        ActionReply                          reply;
+        QMap<int, QByteArray>::ConstIterator it=stateWire.constFind(fields);
+
+        if(it==stateWire.constEnd())
+            it=stateWire.insert(fields, state.toWire(fields));
+
+        reply.addData("state", it.value());
+        reply.addData("generation", stateGeneration);
+        reply.addData("cmd", cmd);
+        timings.add(Stats::PHASE_SERIALIZE, timer);
+        return reply;
+    }
+
+    QStringList args;
+
+    if(fields&State::FIELD_STATUS)
+        args << "--status";
+    if(fields&State::FIELD_DEFAULTS)
+        args << "--defaults";
+    if(fields&State::FIELD_RULES)
+        args << "--list";
+    if(fields&State::FIELD_MODULES)
+        args << "--modules";
+    return run(args, cmd);
+}
+
+// Re-read the UFW state only if its files have changed since it was last read. The fingerprint is taken before
+// reading, so that a change whilst reading causes the next call to re-read. As the helper exits shortly after its last
+// action, the state is also cached on disk - so the files are only parsed again once they have changed.
+bool Helper::updateStateCache()
+{
+    QByteArray fp=State::fingerprint();
+
+    if(fp!=stateFingerprint)
+    {
+        State newState;
+
+        stateFingerprint=QByteArray();
+        stateWire.clear();
+        if(!newState.readCache(fp))
+        {
+            newState=State();
+            if(!newState.load(State::FIELD_ALL))
+                return false;
+            newState.writeCache(fp);
+        }
+        state=newState;
+        stateFingerprint=fp;
+        stateGeneration=State::generation();
+    }
+    return true;
+}
+
+// Profile contents, re-read only if a profile has been added, removed, or changed.
+QVariantMap Helper::readProfiles()
+{
+    QDir                       dir(KCM_UFW_DIR);
+    QStringList                names=dir.entryList(QStringList() << "*"PROFILE_EXTENSION),
+                               files;
+    QStringList::ConstIterator it(names.constBegin()),
+                               end(names.constEnd());
+
+    files << dir.absolutePath();
+    for(; it!=end; ++it)
+        files << dir.absoluteFilePath(*it);
+
+    QByteArray fp=State::fingerprint(files);
+
+    if(fp!=profilesFingerprint)
+    {
+        profiles.clear();
+        for(it=names.constBegin(); it!=end; ++it)
+        {
+            QFile f(dir.absoluteFilePath(*it));
+
+            if(f.open(QIODevice::ReadOnly))
+                profiles.insert(*it, f.readAll());
+        }
+        profilesFingerprint=fp;
+    }
+    return profiles;
+}
+
 ActionReply Helper::run(const QStringList &args, const QString &cmd)
 {
-    QProcess    ufw;
     ActionReply reply;
+    int         exitCode(0);
+    QByteArray  response;
 
     qDebug() << __FUNCTION__ << args;
-    ufw.start(HELPER_DIR "/kcm_ufw_helper.py", args, QIODevice::ReadOnly);
-    if (ufw.waitForStarted())
-        ufw.waitForFinished();
-
-    int exitCode(ufw.exitCode());
+    if(!runDaemon(args, exitCode, response))
+    {
+        qDebug() << "Failed to use daemon, running helper directly";
+        runProcess(args, exitCode, response);
+    }
 
     if(0!=exitCode)
     {
         reply=ActionReply::HelperErrorReply;
         reply.setErrorCode(exitCode);
-        reply.addData("response", ufw.readAllStandardError());
     }
-    else
-        reply.addData("response", ufw.readAllStandardOutput());
+    reply.addData("response", response);
     reply.addData("cmd", cmd);
     return reply;
 }
 
+// Run the python helper as a new process - the request is written to its stdin, and the reply read from its stdout,
+// as per the daemon.
+void Helper::runProcess(const QStringList &args, int &exitCode, QByteArray &response)
+{
+    QProcess      ufw;
+    QElapsedTimer timer;
+
+    timer.start();
+    ufw.start(PY_HELPER, QStringList() << "--stdin");
+    if(!ufw.waitForStarted())
+    {
+        exitCode=STATUS_OPERATION_FAILED;
+        response=QByteArray("Failed to start helper");
+        return;
+    }
+    timings.add(Stats::PHASE_SPAWN, timer);
+
+    bool ok=writeRequest(ufw, args);
+
+    ufw.closeWriteChannel();
+    ok=ok && readReply(ufw, exitCode, response, timings);
+    ufw.waitForFinished();
+
+    if(!ok)
+    {
+        exitCode=0==ufw.exitCode() ? (int)STATUS_OPERATION_FAILED : ufw.exitCode();
+        response=ufw.readAllStandardError();
+    }
+}
+
+// Send the arguments to the long-lived python helper - see writeRequest() and readReply() for the format.
+bool Helper::runDaemon(const QStringList &args, int &exitCode, QByteArray &response)
+{
+    QLocalSocket  socket;
+    QElapsedTimer timer;
+
+    timer.start();
+    if(!connectToDaemon(socket))
+        return false;
+    timings.add(Stats::PHASE_SPAWN, timer);
+
+    // Once part of the request has been sent, it might have been acted upon - therefore dont allow caller to re-run
+    // it, even if we fail to send the rest or read the reply.
+    if(!writeRequest(socket, args) || !readReply(socket, exitCode, response, timings))
+    {
+        exitCode=STATUS_OPERATION_FAILED;
+        response=QByteArray("Failed to communicate with helper");
+    }
+    return true;
+}
+
 }
 
 KDE4_AUTH_HELPER_MAIN("org.kde.ufw", UFW::Helper)
@@ -27,6 +27,8 @@
 #include <QtCore/QObject>
 #include <QtCore/QVariantMap>
 #include <kauth.h>
+#include "state.h"
+#include "stats.h"
 
 class QStringList;
 class QByteArray;
@@ -52,32 +54,57 @@ class Helper : public QObject
         STATUS_OPERATION_FAILED  = -102,
     };
 
+    Helper();
+
     public Q_SLOTS:
 
     ActionReply query(const QVariantMap &args);
     ActionReply viewlog(const QVariantMap &args);
     ActionReply modify(const QVariantMap &args);
+    ActionReply stats(const QVariantMap &args);
+    ActionReply managestats(const QVariantMap &args);
+
+    private Q_SLOTS:
+
+    void        saveStatistics();
 
     private:
 
+    ActionReply followLog(const QString &fileName, quint64 inode, qint64 offset);
+    ActionReply readHistory(const QString &fileName, const QByteArray &olderThan, int maxLines);
+    ActionReply readWindow(const QString &fileName, qint64 since, qint64 until, int maxLines);
     ActionReply setStatus(const QVariantMap &args, const QString &cmd);
-    ActionReply setDefaults(const QVariantMap &args, const QString &cmd);
-    ActionReply setModules(const QVariantMap &args, const QString &cmd);
     ActionReply setProfile(const QVariantMap &args, const QString &cmd);
     ActionReply saveProfile(const QVariantMap &args, const QString &cmd);
     ActionReply deleteProfile(const QVariantMap &args, const QString &cmd);
-    ActionReply addRules(const QVariantMap &args, const QString &cmd);
-    ActionReply removeRule(const QVariantMap &args, const QString &cmd);
-    ActionReply moveRule(const QVariantMap &args, const QString &cmd);
-    ActionReply editRule(const QVariantMap &args, const QString &cmd);
+    ActionReply runOp(const QVariantMap &args, const QString &cmd);
+    ActionReply batch(const QVariantMap &args, const QString &cmd);
 //     ActionReply editRuleDescr(const QVariantMap &args, const QString &cmd);
     ActionReply reset(const QString &cmd);
     ActionReply run(const QStringList &args, const QString &cmd);
-    ActionReply run(const QStringList &args, const QStringList &second, const QString &cmd);
+    ActionReply run(const QStringList &args, int fields, const QString &cmd, quint64 clientGeneration=0);
+    ActionReply readState(int fields, const QString &cmd);
+    bool        updateStateCache();
+    void        addGeneration(ActionReply &reply);
+    QVariantMap readProfiles();
+    void        recordTimings(const ActionReply &reply, const QString &cmd, const QElapsedTimer &timer);
+    bool        runDaemon(const QStringList &args, int &exitCode, QByteArray &response);
+    void        runProcess(const QStringList &args, int &exitCode, QByteArray &response);
 
     private:
 
-    LogLister *lister;
+    // UFW state, and profiles, as last read - these are only re-read when the fingerprints of their files change
+    State                 state;
+    QByteArray            stateFingerprint;
+    quint64               stateGeneration;
+    QMap<int, QByteArray> stateWire;
+    QByteArray            profilesFingerprint;
+    QVariantMap           profiles;
+    LogLister             *lister;
+    // Latency of each query and modify command, and the phase times of the command currently being run
+    Stats                 statistics;
+    Stats::Timings        timings;
+    int                   unsavedTimings;
 };
 
 }
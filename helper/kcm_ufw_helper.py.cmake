@@ -37,6 +37,10 @@ import getopt
 import shutil
 import hashlib
 import io
+import socket
+import struct
+import fcntl
+import time
 
 from xml.etree import ElementTree as etree
 from copy import deepcopy
@@ -53,6 +57,12 @@ OLD_DESCR_FILE = "/etc/ufw/descriptions"
 DESCR_FILE     = "/etc/kcm_ufw/descriptions"
 DEFAULTS_FILE  = "@DATA_INSTALL_DIR@/kcm_ufw/defaults"
 
+# Keep in sync with helper.cpp
+DAEMON_SOCKET       = "/var/run/kcm_ufw_helper.socket"
+DAEMON_LOCK_FILE    = "/var/run/kcm_ufw_helper.lock"
+DAEMON_IDLE_TIMEOUT = 300 # seconds
+STATE_FILES         = ["/etc/ufw/ufw.conf", "/etc/default/ufw", "/etc/ufw/user.rules", "/etc/ufw/user6.rules"]
+
 ERROR_FAILED_TO_SET_STATUS      = -1
 ERROR_INVALID_INDEX             = -2
 ERROR_INVALID_XML_NO_RULE       = -3
@@ -61,10 +71,17 @@ ERROR_INVALID_XML_NO_DEFAULTS   = -5
 ERROR_INVALID_XML_NO_MODULES    = -6
 
 
+# Set whilst a batch of modifications is being applied - see Batch
+batchActive = False
+
+# Seconds spent reloading the firewall whilst running the current request - reported by the daemon
+reloadTime = 0.0
+
 class UFWFrontend(ufw.frontend.UFWFrontend):
 
     def __init__(self, dryrun):
-        ufw.frontend.UFWFrontend.__init__(self, dryrun)
+        # NOTE: 'ufw' is re-bound to a frontend instance below, so cannot use ufw.frontend.UFWFrontend here
+        super(UFWFrontend, self).__init__(dryrun)
         # Compatibility for ufw 0.31
         # This is a better way of handling method renames instead of putting
         # try/except blocks all over the whole application code
@@ -77,6 +94,11 @@ class UFWFrontend(ufw.frontend.UFWFrontend):
             self.backend._is_enabled
         except AttributeError:
             self.backend._is_enabled = self.backend.is_enabled
+        if batchActive:
+            # Whilst a batch is in progress only update the files, the firewall is reloaded when it is committed
+            self.backend._is_enabled = lambda: False
+            if hasattr(self.backend, 'is_enabled'):
+                self.backend.is_enabled = lambda: False
 
 
 def localizeUfw():
@@ -230,6 +252,19 @@ def getRulesList(ufw):
                 app_rules.append(t)
         yield (i, r)
 
+# The KCM numbers rules as they are listed by getRulesList() - where application rules, which UFW stores for both IPv4
+# and IPv6, are only listed once. Convert such a (1-based) position into UFW's own numbering, as used by
+# get_rule_by_number() and delete_rule(). If 'allowEnd' is set, then the position may be one past the last rule.
+def ufwRuleNumber(ufw, position, allowEnd=False):
+    count=0
+    for i, r in getRulesList(ufw):
+        count+=1
+        if count == position:
+            return i+1
+    if allowEnd and position == count+1:
+        return len(ufw.backend.get_rules())+1
+    error("ERROR: Invalid index", ERROR_INVALID_INDEX)
+
 def encodeText(str):
     str=str.replace("&", "&amp;")
     str=str.replace("<", "&lt;")
@@ -400,6 +435,7 @@ def addRule(ufw, xml):
 
 def updateRule(ufw, xml):
     rule=fromXml(xml)
+    rule.position=ufwRuleNumber(ufw, rule.position)
     deleted=False
     try:
         prev=deepcopy(ufw.backend.get_rule_by_number(rule.position))
@@ -411,6 +447,7 @@ def updateRule(ufw, xml):
     except Exception as e:
         if deleted:
             insertRule(ufw, prev)
+        raise
 
 # def updateRuleDescr(ufw, xml):
 #     rule=fromXml(xml)
@@ -423,11 +460,9 @@ def removeRule(ufw, index):
     parts=index.split(':')
     try:
         if 2==len(parts):
-            idx=int(parts[0])
+            idx=ufwRuleNumber(ufw, int(parts[0]))
         else:
-            idx=int(index)
-        if idx<1 or idx>(ufw.backend.get_rules_count(False)+ufw.backend.get_rules_count(True)):
-            error("ERROR: Invalid index", ERROR_INVALID_INDEX)
+            idx=ufwRuleNumber(ufw, int(index))
 #         if 2==len(parts):
 #             removeDescription(parts[1])
 #         else:
@@ -450,27 +485,101 @@ def moveRule(ufw, indexes):
     toIndex=int(idx[1])
     if fromIndex == toIndex:
         error("ERROR: Source and destination cannot be the same", ERROR_INVALID_INDEX)
+    fromIndex=ufwRuleNumber(ufw, fromIndex)
     rule=ufw.backend.get_rule_by_number(fromIndex).dup_rule()
     ufw.delete_rule(fromIndex, True)
-    rule.position=toIndex
+    rule.position=ufwRuleNumber(ufw, toIndex, True)
     insertRule(ufw, rule)
 
+# Re-order all rules in one pass. 'order' is a comma separated list of the current (1-based) rule positions, in
+# their new order. The rules are replaced in bulk, so each rules file is only written once. UFW always keeps IPv6 rules
+# after those for IPv4, so an order that places an IPv6 rule before an IPv4 one is rejected - rather than silently not
+# being applied.
+def reorderRules(ufw, order):
+    try:
+        indexes=[int(i) for i in order.split(',')]
+    except ValueError:
+        error("ERROR: Invalid input type", ERROR_INVALID_INDEX)
+    rules=[r.dup_rule() for i, r in getRulesList(ufw)]
+    if sorted(indexes) != list(range(1, len(rules)+1)):
+        error("ERROR: Invalid rule order", ERROR_INVALID_INDEX)
+    seenV6=False
+    for idx in indexes:
+        if rules[idx-1].v6:
+            seenV6=True
+        elif seenV6:
+            error("ERROR: IPv6 rules cannot be placed before IPv4 rules", ERROR_INVALID_INDEX)
+    write=beginReplaceRules(ufw)
+    for idx in indexes:
+        rule=rules[idx-1]
+        rule.set_position(0)
+        # Application rules are listed once, but stored for both IPv4 and IPv6 - so let UFW re-create both. Others
+        # are in the list once for each IP version.
+        if rule.dapp or rule.sapp:
+            insertRule(ufw, rule)
+        else:
+            insertRule(ufw, rule, 'v6' if rule.v6 else 'v4')
+    endReplaceRules(ufw, write)
+
 def reset(ufw):
     loadDefaultSettings(ufw)
     clearRules(ufw)
     ufw.reset(True)
     if ufw.backend._is_enabled():
-        ufw.set_enabled(False)
-        ufw.set_enabled(True)
+        reloadFirewall(ufw)
 
 def clearRules(ufw):
 #     removeDescriptions()
-    count=ufw.backend.get_rules_count(False)+ufw.backend.get_rules_count(True)
-    for num in range(0, count):
+    endReplaceRules(ufw, beginReplaceRules(ufw))
+    if ufw.backend._is_enabled():
+        reloadFirewall(ufw)
+
+def reloadFirewall(ufw):
+    global reloadTime
+    start=time.time()
+    ufw.set_enabled(False)
+    ufw.set_enabled(True)
+    reloadTime+=time.time()-start
+
+# Remove all user rules, and defer writing the rules files until endReplaceRules() - so that rules added in
+# between only cause each file to be written once, rather than once per rule.
+def beginReplaceRules(ufw):
+    ufw.backend.rules=[]
+    ufw.backend.rules6=[]
+    write=ufw.backend._write_rules
+    ufw.backend._write_rules=lambda v6=False: None
+    return write
+
+def endReplaceRules(ufw, write):
+    del ufw.backend._write_rules
+    # Both files were cleared, so always write both
+    writeRulesFile(ufw, write, False)
+    writeRulesFile(ufw, write, True)
+
+# UFW copies its temporary file over the rules file in place, so a reader (or a crash) could see it part written.
+# Therefore, UFW is pointed at a copy of the file in the same folder (the copy keeps its permissions, and UFW reads the
+# file that it replaces), which is then renamed over the original - replacing it atomically.
+def writeRulesFile(ufw, write, v6):
+    key='rules6' if v6 else 'rules'
+    name=ufw.backend.files[key]
+    if not os.path.exists(name):
+        write(v6)
+        return
+    tmp=os.path.join(os.path.dirname(name), '.'+os.path.basename(name)+'.new')
+    shutil.copy2(name, tmp)
+    try:
+        ufw.backend.files[key]=tmp
+        write(v6)
+        fd=os.open(tmp, os.O_RDONLY)
         try:
-            ufw.delete_rule(1, True)
-        except ufw.common.UFWError as e:
-            pass
+            os.fsync(fd)
+        finally:
+            os.close(fd)
+        os.rename(tmp, name)
+    finally:
+        ufw.backend.files[key]=name
+        if os.path.exists(tmp):
+            os.unlink(tmp)
 
 def getModules(ufw, xmlStr):
     xmlStr.write("<modules enabled=\"")
@@ -500,91 +609,330 @@ def setModules(ufw, xml):
 #             xmlStr.write(profile)
 #     xmlStr.write("\" />")
 
+class HelperError(Exception):
+    pass
+
+# A set of modifications that are applied as a single transaction. Whilst active, changes are only written to the
+# UFW files - the firewall is then reloaded once when the batch is committed. If any modification fails, the files
+# are restored to their previous contents.
+class Batch:
+    def __init__(self, ufw):
+        global batchActive
+        self.enabled=ufw.backend._is_enabled()
+        self.files={}
+        for key in ('defaults', 'conf', 'rules', 'rules6'):
+            if key in ufw.backend.files:
+                name=ufw.backend.files[key]
+                try:
+                    self.files[name]=open(name, 'rb').read()
+                except IOError:
+                    self.files[name]=None
+        batchActive=True
+
+    # Returns the frontend to use after the batch
+    def commit(self):
+        global batchActive
+        batchActive=False
+        ufw=UFWFrontend(False)
+        if self.enabled:
+            reloadFirewall(ufw)
+        return ufw
+
+    # Returns the frontend to use after the batch
+    def rollback(self):
+        global batchActive
+        batchActive=False
+        for name, data in self.files.items():
+            try:
+                if data is None:
+                    if os.path.exists(name):
+                        os.unlink(name)
+                else:
+                    tmp=name+'.kcm_ufw'
+                    f=open(tmp, 'wb')
+                    f.write(data)
+                    f.close()
+                    os.rename(tmp, name)
+            except (IOError, OSError):
+                pass
+        return UFWFrontend(False)
+
 def error(str, rv):
-    print >> sys.stderr, str
-    #sys.exit(rv)
+    raise HelperError(str)
 
-def main():
+# Run the options given in 'argv'. Returns a tuple of (exitCode, output) - where output is either the
+# XML response or the error message.
+def runArgv(argv):
     try:
-#         opts, args = getopt.getopt(sys.argv[1:], "hse:df:la:u:U:r:m:tiI:x",
+#         opts, args = getopt.getopt(argv, "hse:df:la:u:U:r:m:tiI:x",
 #                                    ["help", "status", "setEnabled=", "defaults", "setDefaults=", "list", "add=",
 #                                     "update=", "updateDescr=", "remove=", "move=", "reset", "modules", "setModules=", "clearRules"])
-        opts, args = getopt.getopt(sys.argv[1:], "hse:df:la:u:U:r:m:tiI:x",
+        opts, args = getopt.getopt(argv, "hse:df:la:u:U:r:m:O:tiI:xbR",
                                    ["help", "status", "setEnabled=", "defaults", "setDefaults=", "list", "add=",
-                                    "update=", "remove=", "move=", "reset", "modules", "setModules=", "clearRules"])
+                                    "update=", "remove=", "move=", "reorder=", "reset", "modules", "setModules=",
+                                    "clearRules", "batch", "replaceRules"])
     except getopt.GetoptError as err:
-        # print help information and exit:
-        print >> sys.stderr, str(err) # will print something like "option -a not recognized"
-        usage()
-        sys.exit(1)
+        return (1, str(err)) # will be something like "option -a not recognized"
+    return runArgs(opts)
+
+# Run the given (option, value) pairs. These may be a generator, in which case each option is applied as it is
+# produced - see Request.
+def runArgs(opts):
+    global ufw
+    global reloadTime
+    reloadTime=0.0
 #     loadDescriptions()
     returnXml = False
     xmlOut = io.StringIO()
     xmlOut.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?><ufw>")
-    for o, a in opts:
-        if o in ("-h", "--help"):
-            usage()
-            sys.exit()
-        elif o in ("-s", "--status"):
-            getStatus(ufw, xmlOut)
-            returnXml=True
-        elif o in ("-e", "--setEnabled"):
-            setEnabled(ufw, a)
-        elif o in ("-d", "--defaults"):
-            getDefaults(ufw, xmlOut)
-            returnXml=True
-        elif o in ("-f", "--setDefaults"):
-            setDefaults(ufw, a)
-        elif o in ("-l", "--list"):
-            getRules(ufw, xmlOut)
-            returnXml=True
-        elif o in ("-a", "--add"):
-            addRule(ufw, a)
-        elif o in ("-u", "--update"):
-            updateRule(ufw, a)
-#         elif o in ("-U", "--updateDescr"):
-#             updateRuleDescr(ufw, a)
-        elif o in ("-r", "--remove"):
-            removeRule(ufw, a)
-        elif o in ("-m", "--move"):
-            moveRule(ufw, a)
-        elif o in ("-t", "--reset"):
-            reset(ufw)
-        elif o in ("-i", "--modules"):
-            getModules(ufw, xmlOut)
-            returnXml=True
-        elif o in ("-I", "--setModules"):
-            setModules(ufw, a)
-        elif o in ("-x", "--clearRules"):
-            clearRules(ufw)
-        else:
-            usage()
+    batch = None
+    replacement = None
+    try:
+        for o, a in opts:
+            # Rules replaced via --replaceRules are those given by the --add options that follow it
+            if replacement is not None and o not in ("-a", "--add"):
+                endReplaceRules(ufw, replacement)
+                replacement=None
+            if o in ("-h", "--help"):
+                return (0, usage())
+            elif o in ("-b", "--batch"):
+                if batch is None:
+                    batch=Batch(ufw)
+                    ufw=UFWFrontend(False)
+            elif o in ("-R", "--replaceRules"):
+                # Only reload the firewall once all of the rules are added
+                if batch is None:
+                    batch=Batch(ufw)
+                    ufw=UFWFrontend(False)
+                replacement=beginReplaceRules(ufw)
+            elif o in ("-s", "--status"):
+                getStatus(ufw, xmlOut)
+                returnXml=True
+            elif o in ("-e", "--setEnabled"):
+                setEnabled(ufw, a)
+            elif o in ("-d", "--defaults"):
+                getDefaults(ufw, xmlOut)
+                returnXml=True
+            elif o in ("-f", "--setDefaults"):
+                setDefaults(ufw, a)
+                # setDefaults() re-creates the frontend when changing IPv6 support, so ours is now out of date
+                ufw=UFWFrontend(False)
+            elif o in ("-l", "--list"):
+                getRules(ufw, xmlOut)
+                returnXml=True
+            elif o in ("-a", "--add"):
+                addRule(ufw, a)
+            elif o in ("-u", "--update"):
+                updateRule(ufw, a)
+#             elif o in ("-U", "--updateDescr"):
+#                 updateRuleDescr(ufw, a)
+            elif o in ("-r", "--remove"):
+                removeRule(ufw, a)
+            elif o in ("-m", "--move"):
+                moveRule(ufw, a)
+            elif o in ("-O", "--reorder"):
+                # Only reload the firewall once all of the rules are re-added
+                if batch is None:
+                    batch=Batch(ufw)
+                    ufw=UFWFrontend(False)
+                reorderRules(ufw, a)
+            elif o in ("-t", "--reset"):
+                reset(ufw)
+            elif o in ("-i", "--modules"):
+                getModules(ufw, xmlOut)
+                returnXml=True
+            elif o in ("-I", "--setModules"):
+                setModules(ufw, a)
+            elif o in ("-x", "--clearRules"):
+                clearRules(ufw)
+            else:
+                return (1, usage())
+        if replacement is not None:
+            endReplaceRules(ufw, replacement)
+        if batch is not None:
+            ufw=batch.commit()
+            batch=None
+    except Exception as e:
+        return (1, str(e))
+    finally:
+        # A batch is only left open if an option failed, or was not recognised - so undo what it changed
+        if batch is not None:
+            ufw=batch.rollback()
 #     saveDescriptions()
     if returnXml:
         xmlOut.write("</ufw>")
-        print (xmlOut.getvalue())
+        return (0, xmlOut.getvalue())
+    return (0, '')
+
+# Fingerprint of the files UFW keeps its state in - used by the daemon to detect changes made behind its back
+# (e.g. via the 'ufw' command line tool)
+def stateFingerprint():
+    fp=[]
+    for f in STATE_FILES:
+        try:
+            st=os.stat(f)
+            fp.append((st.st_ino, st.st_size, st.st_mtime))
+        except OSError:
+            fp.append(None)
+    return fp
+
+# 'read' is a function that returns up to 'size' bytes, or an empty string at the end of the stream
+def recvAll(read, size):
+    data=b''
+    while len(data) < size:
+        chunk=read(size-len(data))
+        if not chunk:
+            return None
+        data+=chunk
+    return data
+
+# Frames are a 32-bit big-endian length, followed by that many bytes of UTF-8 data
+def readFrame(read):
+    header=recvAll(read, 4)
+    if header is None:
+        return None
+    size=struct.unpack('>I', header)[0]
+    if 0==size:
+        return ''
+    data=recvAll(read, size)
+    if data is None:
+        return None
+    return data.decode('utf-8')
+
+# A request is a list of option frames (e.g. '--add=<xml>'), terminated by an empty frame. The options are yielded
+# as each frame arrives - so that rules are applied whilst the rest of the request is still being sent, and there is
+# no limit on the number of rules in a request.
+class Request:
+    def __init__(self, read):
+        self.read=read
+        self.complete=False
+
+    def options(self):
+        while not self.complete:
+            arg=readFrame(self.read)
+            if arg is None:
+                raise HelperError("ERROR: Incomplete request")
+            if arg == '':
+                self.complete=True
+            else:
+                name, sep, value=arg.partition('=')
+                yield (name, value)
+
+    # Skip any options not read, e.g. due to an error, so that the reply is not sent before the request is complete
+    def drain(self):
+        try:
+            for o in self.options():
+                pass
+        except HelperError:
+            pass
+
+# A reply is a 32-bit big-endian exit code, followed by a frame containing the output, and then the time spent in
+# the UFW backend and in reloading the firewall - as 64-bit big-endian microseconds.
+def writeReply(write, code, output, backendTime, reloadTime):
+    data=output.encode('utf-8')
+    write(struct.pack('>iI', code, len(data))+data+
+          struct.pack('>QQ', int(max(backendTime, 0)*1000000), int(reloadTime*1000000)))
+
+# Read a request, run it, and write the reply. Returns False if the request was incomplete.
+def serve(read, write):
+    request=Request(read)
+    start=time.time()
+    code, output=runArgs(request.options())
+    request.drain()
+    if not request.complete:
+        return False
+    writeReply(write, code, output, time.time()-start-reloadTime, reloadTime)
+    return True
+
+# Long-lived helper - keeps the UFW backend loaded, and serves requests from kcm_ufw_helper over a local socket.
+def daemon():
+    global ufw
+    lockFile=open(DAEMON_LOCK_FILE, 'w')
+    try:
+        fcntl.lockf(lockFile, fcntl.LOCK_EX|fcntl.LOCK_NB)
+    except IOError:
+        return # Another instance is already running
+    try:
+        os.unlink(DAEMON_SOCKET)
+    except OSError:
+        pass
+    server=socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    oldMask=os.umask(0o077)
+    server.bind(DAEMON_SOCKET)
+    os.umask(oldMask)
+    server.listen(5)
+    server.settimeout(DAEMON_IDLE_TIMEOUT)
+    fingerprint=stateFingerprint()
+    while True:
+        try:
+            conn, addr=server.accept()
+        except socket.timeout:
+            break
+        try:
+            conn.settimeout(None)
+            current=stateFingerprint()
+            if current != fingerprint:
+                ufw=UFWFrontend(False)
+            serve(conn.recv, conn.sendall)
+            # Any changes we made are already reflected in 'ufw'
+            fingerprint=stateFingerprint()
+        except (OSError, IOError):
+            pass
+        finally:
+            conn.close()
+    server.close()
+    try:
+        os.unlink(DAEMON_SOCKET)
+    except OSError:
+        pass
+
+def main():
+    if '--daemon' in sys.argv[1:]:
+        daemon()
+        return
+    if '--stdin' in sys.argv[1:]:
+        # Request is read from stdin, and the reply written to stdout, as per the daemon. Anything else written to
+        # stdout whilst running the request is sent to stderr, so as to not corrupt the reply.
+        out=sys.stdout.buffer
+        sys.stdout=sys.stderr
+        if serve(sys.stdin.buffer.read, out.write):
+            out.flush()
+        return
+    code, output=runArgv(sys.argv[1:])
+    if 0!=code:
+        print (output, file=sys.stderr)
+        sys.exit(code)
+    elif output != '':
+        print (output)
 
 def usage():
-    print ("Python helper for UFW KCM")
-    print ("")
-    print ("(C) Craig Drummond, 2011")
-    print ("")
-    print ("Usage:")
-    print ("    "+sys.argv[0]+" --status")
-    print ("    "+sys.argv[0]+" --setEnabled <true/false>")
-    print ("    "+sys.argv[0]+" --defaults")
-    print ("    "+sys.argv[0]+" --setDefaults <xml>")
-    print ("    "+sys.argv[0]+" --list")
-    print ("    "+sys.argv[0]+" --add <xml>")
-    print ("    "+sys.argv[0]+" --update <xml>")
-#     print ("    "+sys.argv[0]+" --updateDescr <xml>")
-    print ("    "+sys.argv[0]+" --remove <index>")
-    print ("    "+sys.argv[0]+" --remove <index:hash>")
-    print ("    "+sys.argv[0]+" --move <from:to>")
-    print ("    "+sys.argv[0]+" --reset")
-    print ("    "+sys.argv[0]+" --modules")
-    print ("    "+sys.argv[0]+" --setModules <xml>")
-    print ("    "+sys.argv[0]+" --clearRules")
+    lines=[]
+    lines.append("Python helper for UFW KCM")
+    lines.append("")
+    lines.append("(C) Craig Drummond, 2011")
+    lines.append("")
+    lines.append("Usage:")
+    lines.append("    "+sys.argv[0]+" --status")
+    lines.append("    "+sys.argv[0]+" --setEnabled <true/false>")
+    lines.append("    "+sys.argv[0]+" --defaults")
+    lines.append("    "+sys.argv[0]+" --setDefaults <xml>")
+    lines.append("    "+sys.argv[0]+" --list")
+    lines.append("    "+sys.argv[0]+" --add <xml>")
+    lines.append("    "+sys.argv[0]+" --update <xml>")
+#     lines.append("    "+sys.argv[0]+" --updateDescr <xml>")
+    lines.append("    "+sys.argv[0]+" --remove <index>")
+    lines.append("    "+sys.argv[0]+" --remove <index:hash>")
+    lines.append("    "+sys.argv[0]+" --move <from:to>")
+    lines.append("    "+sys.argv[0]+" --reorder <index,index,...>")
+    lines.append("    "+sys.argv[0]+" --reset")
+    lines.append("    "+sys.argv[0]+" --modules")
+    lines.append("    "+sys.argv[0]+" --setModules <xml>")
+    lines.append("    "+sys.argv[0]+" --clearRules")
+    lines.append("    "+sys.argv[0]+" --batch <modifications>")
+    lines.append("    "+sys.argv[0]+" --replaceRules --add <xml> [--add <xml>...]")
+    lines.append("    "+sys.argv[0]+" --daemon")
+    lines.append("    "+sys.argv[0]+" --stdin")
+    return '\n'.join(lines)
 
 if __name__ == "__main__":
     main()
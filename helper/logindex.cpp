@@ -0,0 +1,263 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logindex.h"
+#include "logentry.h"
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+#include <sys/stat.h>
+#include <time.h>
+
+namespace UFW
+{
+
+#define INDEX_DIR     "/var/lib/kcm_ufw/logindex"
+#define INDEX_MAGIC   0x4b554958 // "KUIX"
+#define INDEX_VERSION 3
+#define INDEX_STEP    (64*1024)  // Bytes of the log between entries
+#define CHECK_SIZE    256        // Bytes of the log's first line kept with the index
+
+// Name of the index of the file with the given device and inode - an inode number is only unique within a filesystem
+static QString indexName(quint64 device, quint64 inode)
+{
+    return QString::number(device)+'-'+QString::number(inode);
+}
+
+static QString indexName(const QString &fileName)
+{
+    struct stat info;
+
+    return 0==stat(QFile::encodeName(fileName).constData(), &info)
+            ? indexName((quint64)info.st_dev, (quint64)info.st_ino) : QString();
+}
+
+// Start of the first line of a log - or an empty array if this has not yet been completely written
+static QByteArray lineStart(QFile &file)
+{
+    QByteArray start=file.seek(0) ? file.read(CHECK_SIZE) : QByteArray();
+    int        eol=start.indexOf('\n');
+
+    return eol>=0 ? start.left(eol) : start.size()<CHECK_SIZE ? QByteArray() : start;
+}
+
+void LogIndex::load(const QString &dir, quint64 device, quint64 inode)
+{
+    QFile file(dir+'/'+indexName(device, inode));
+
+    clear();
+    indexDir=dir;
+    logDevice=device;
+    logInode=inode;
+    modified=false;
+    if(!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream stream(&file);
+    quint32     magic,
+                version,
+                count;
+    quint64     storedDevice,
+                storedInode;
+
+    stream >> magic >> version >> storedDevice >> storedInode >> indexed >> check >> count;
+    if(INDEX_MAGIC!=magic || INDEX_VERSION!=version || storedDevice!=device || storedInode!=inode ||
+       QDataStream::Ok!=stream.status())
+    {
+        clear();
+        return;
+    }
+
+    entries.resize(count);
+    for(quint32 i=0; i<count; ++i)
+        stream >> entries[i].offset >> entries[i].time;
+    if(QDataStream::Ok!=stream.status())
+        clear();
+}
+
+bool LogIndex::save()
+{
+    if(!modified || !logInode)
+        return true;
+
+    QFile file(indexDir+'/'+indexName(logDevice, logInode));
+
+    QDir().mkpath(indexDir);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream                      stream(&file);
+    QVector<Entry>::ConstIterator    it(entries.constBegin()),
+                                     end(entries.constEnd());
+
+    stream << (quint32)INDEX_MAGIC << (quint32)INDEX_VERSION << logDevice << logInode << indexed << check
+           << (quint32)entries.count();
+    for(; it!=end; ++it)
+        stream << (*it).offset << (*it).time;
+    file.close();
+    file.setPermissions(QFile::ReadOwner|QFile::WriteOwner|QFile::ReadGroup|QFile::ReadOther);
+    modified=false;
+    return QDataStream::Ok==stream.status();
+}
+
+// Called when the log has been truncated, or replaced
+void LogIndex::clear()
+{
+    modified=modified || indexed || !entries.isEmpty() || !check.isEmpty();
+    indexed=0;
+    check.clear();
+    entries.clear();
+}
+
+// Clear the index if it is not of this log - i.e. if the log has been truncated, or its inode has been re-used by a new
+// log. This changes the file's position.
+void LogIndex::validate(QFile &file)
+{
+    QByteArray start=lineStart(file);
+
+    if(file.size()<indexed || (!check.isEmpty() && start!=check))
+        clear();
+    if(!start.isEmpty() && start!=check)
+    {
+        check=start;
+        modified=true;
+    }
+}
+
+void LogIndex::setIndexedTo(qint64 offset)
+{
+    if(offset>indexed)
+    {
+        indexed=offset;
+        modified=true;
+    }
+}
+
+// Whether a line at 'offset' would be added - lines before indexedTo() have already been considered, so are ignored
+bool LogIndex::wants(qint64 offset) const
+{
+    return offset>=indexed && (entries.isEmpty() || offset>=entries.last().offset+INDEX_STEP);
+}
+
+void LogIndex::add(qint64 offset, const char *line, int length)
+{
+    if(!wants(offset))
+        return;
+
+    LogEntry entry;
+
+    if(entry.parse(line, length))
+    {
+        Entry e;
+
+        e.offset=offset;
+        e.time=logTime.toTime(entry.timestamp, ::time(0L));
+        if(e.time)
+        {
+            entries.append(e);
+            modified=true;
+        }
+    }
+}
+
+// Offset from which to read to find the first line at, or after, 'time' - i.e. the last indexed line before it
+qint64 LogIndex::find(qint64 time) const
+{
+    int low=0,
+        high=entries.count();
+
+    while(low<high)
+    {
+        int mid=(low+high)/2;
+
+        if(entries[mid].time<time)
+            low=mid+1;
+        else
+            high=mid;
+    }
+    return low>0 ? entries[low-1].offset : 0;
+}
+
+// The indexes of each log are kept in their own folder, named from the log's path - so that those of other logs are
+// not affected when this log's old indexes are removed
+LogIndexes::LogIndexes(const QString &log)
+          : fileName(log)
+          , dir(QLatin1String(INDEX_DIR "/")+
+                QCryptographicHash::hash(QFile::encodeName(QFileInfo(log).absoluteFilePath()),
+                                         QCryptographicHash::Md5).toHex())
+{
+}
+
+LogIndex * LogIndexes::get(QFile &file)
+{
+    struct stat info;
+
+    if(0!=fstat(file.handle(), &info))
+        info.st_dev=info.st_ino=0;
+
+    QPair<quint64, quint64>                           key((quint64)info.st_dev, (quint64)info.st_ino);
+    QMap<QPair<quint64, quint64>, LogIndex>::Iterator it=indexes.find(key);
+
+    if(it==indexes.end())
+    {
+        it=indexes.insert(key, LogIndex());
+        (*it).load(dir, key.first, key.second);
+    }
+    return &(*it);
+}
+
+// Save any changed indexes, and remove those of this log's files that are no longer the current or rotated log - older
+// logs are compressed, and so cannot be seeked within.
+void LogIndexes::save()
+{
+    QMap<QPair<quint64, quint64>, LogIndex>::Iterator it(indexes.begin()),
+                                                      end(indexes.end());
+
+    if(indexes.isEmpty())
+        return;
+
+    for(; it!=end; ++it)
+        (*it).save();
+
+    QStringList                current=QStringList() << indexName(fileName) << indexName(fileName+".1");
+    QDir                       logDir(dir);
+    QStringList                files=logDir.entryList(QDir::Files);
+    QStringList::ConstIterator fIt(files.constBegin()),
+                               fEnd(files.constEnd());
+
+    for(; fIt!=fEnd; ++fIt)
+        if(!current.contains(*fIt))
+            logDir.remove(*fIt);
+
+    // Indexes stored before each log had its own folder are no longer used
+    QDir        topDir(INDEX_DIR);
+    QStringList oldFiles=topDir.entryList(QDir::Files);
+
+    for(fIt=oldFiles.constBegin(), fEnd=oldFiles.constEnd(); fIt!=fEnd; ++fIt)
+        topDir.remove(*fIt);
+}
+
+}
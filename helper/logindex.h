@@ -0,0 +1,103 @@
+#ifndef UFW_LOG_INDEX_H
+#define UFW_LOG_INDEX_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logtime.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QMap>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+class QFile;
+
+namespace UFW
+{
+
+//
+// Sparse index of the times of a log's UFW lines - an entry is kept for the first line in each INDEX_STEP bytes. The
+// index is stored by the log's device and inode, so that it remains valid when the log is rotated (i.e. renamed). Entries are
+// only added after indexedTo(), so the index is extended as new parts of the log are read. As an inode may be re-used
+// by a new log, the start of the log's first line is kept with the index - and validate() clears the index if this
+// no longer matches.
+class LogIndex
+{
+    public:
+
+    LogIndex() : logDevice(0), logInode(0), indexed(0), modified(false) { }
+
+    void    load(const QString &dir, quint64 device, quint64 inode);
+    bool    save();
+    void    clear();
+    void    validate(QFile &file);
+
+    qint64  indexedTo() const { return indexed; }
+    qint64  firstTime() const { return entries.isEmpty() ? 0 : entries.first().time; }
+    void    setIndexedTo(qint64 offset);
+    bool    wants(qint64 offset) const;
+    void    add(qint64 offset, const char *line, int length);
+    qint64  find(qint64 time) const;
+
+    private:
+
+    struct Entry
+    {
+        qint64 offset,
+               time;
+    };
+
+    QString        indexDir;
+    quint64        logDevice,
+                   logInode;
+    qint64         indexed;
+    QByteArray     check;     // Start of the log's first line
+    bool           modified;
+    QVector<Entry> entries;
+    LogTime        logTime;
+};
+
+//
+// The indexes of a log, and its rotated copy, loaded as required. When saved, the indexes of its older logs are
+// removed.
+class LogIndexes
+{
+    public:
+
+    LogIndexes(const QString &log);
+    ~LogIndexes()                   { save(); }
+
+    LogIndex * get(QFile &file);
+    void       save();
+
+    private:
+
+    QString                                  fileName,
+                                             dir;
+    QMap<QPair<quint64, quint64>, LogIndex>  indexes;
+};
+
+}
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "state.h"
+#include "wire.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QMap>
+#include <QtCore/QRegExp>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <sys/stat.h>
+
+namespace UFW
+{
+
+#define UFW_CONF_FILE     "/etc/ufw/ufw.conf"
+#define UFW_DEFAULTS_FILE "/etc/default/ufw"
+#define UFW_RULES_FILE    "/etc/ufw/user.rules"
+#define UFW_RULES6_FILE   "/etc/ufw/user6.rules"
+// UFW versions prior to 0.31 stored the user rules in /lib/ufw
+#define UFW_OLD_RULES_FILE  "/lib/ufw/user.rules"
+#define UFW_OLD_RULES6_FILE "/lib/ufw/user6.rules"
+
+#define TUPLE_PREFIX      "### tuple ###"
+
+#define STATE_DIR         "/var/lib/kcm_ufw"
+#define GENERATION_FILE   STATE_DIR "/generation"
+#define CACHE_FILE        STATE_DIR "/state"
+#define CACHE_MAGIC       0x4b555354 // "KUST"
+#define CACHE_VERSION     1
+
+// Read a KEY=value file, in the same way as UFW - keys and values are lowercased, and quotes removed.
+static bool readConfig(const QString &fileName, QMap<QString, QString> &config)
+{
+    QFile file(fileName);
+
+    if(!file.open(QIODevice::ReadOnly|QIODevice::Text))
+        return false;
+
+    while(!file.atEnd())
+    {
+        QString line=QString::fromUtf8(file.readLine()).trimmed();
+
+        if(line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        int eq=line.indexOf('=');
+
+        if(eq>0)
+        {
+            QString value=line.mid(eq+1).trimmed().toLower();
+
+            while(value.startsWith('\"') || value.startsWith('\''))
+                value=value.mid(1);
+            while(value.endsWith('\"') || value.endsWith('\''))
+                value.chop(1);
+            config[line.left(eq).trimmed().toLower()]=value;
+        }
+    }
+    return true;
+}
+
+// Map iptables policy to UFW policy - as per UFWBackend._get_default_policy()
+static QString toPolicy(const QString &val)
+{
+    if("accept"==val)
+        return "allow";
+    if("accept_no_track"==val)
+        return "allow-without-tracking";
+    if("reject"==val)
+        return "reject";
+    return "deny";
+}
+
+static QString unescapeApp(const QString &app)
+{
+    return "-"==app ? QString() : QString(app).replace("%20", " ");
+}
+
+static bool useOldLocation()
+{
+    return !QFile::exists(UFW_RULES_FILE) && QFile::exists(UFW_OLD_RULES_FILE);
+}
+
+QByteArray State::fingerprint()
+{
+    bool oldLocation=useOldLocation();
+
+    return fingerprint(QStringList() << UFW_CONF_FILE << UFW_DEFAULTS_FILE
+                                     << (oldLocation ? UFW_OLD_RULES_FILE : UFW_RULES_FILE)
+                                     << (oldLocation ? UFW_OLD_RULES6_FILE : UFW_RULES6_FILE));
+}
+
+// UFW copies over its files in place when writing, so the inode usually stays the same - the modification time (to the
+// nanosecond), and the size, are what change. The inode only catches files that are replaced by other tools (e.g. via
+// a rename, as the helper does when replacing all rules), so must not be relied on alone.
+QByteArray State::fingerprint(const QStringList &files)
+{
+    QStringList::ConstIterator it(files.constBegin()),
+                               end(files.constEnd());
+    QByteArray                 fp;
+
+    for(; it!=end; ++it)
+    {
+        struct stat info;
+
+        if(0==::stat(QFile::encodeName(*it).constData(), &info))
+            fp+=QByteArray::number((qulonglong)info.st_ino)+':'+
+                QByteArray::number((qulonglong)info.st_size)+':'+
+                QByteArray::number((qulonglong)info.st_mtim.tv_sec)+'.'+
+                QByteArray::number((qulonglong)info.st_mtim.tv_nsec);
+        fp+=';';
+    }
+    return fp;
+}
+
+quint64 State::generation()
+{
+    QFile      file(GENERATION_FILE);
+    quint64    gen=0;
+    QByteArray storedFp,
+               fp=fingerprint();
+
+    if(file.open(QIODevice::ReadOnly))
+    {
+        gen=file.readLine().trimmed().toULongLong();
+        storedFp=file.readLine().trimmed();
+        file.close();
+    }
+
+    if(0==gen || storedFp!=fp)
+    {
+        ++gen;
+        QDir().mkpath(STATE_DIR);
+        if(file.open(QIODevice::WriteOnly))
+        {
+            QTextStream(&file) << gen << '\n' << fp << '\n';
+            file.close();
+        }
+    }
+    return gen;
+}
+
+// Same as UFWRule.get_app_tuple()
+QString State::Rule::appTuple() const
+{
+    if(dapp.isEmpty() && sapp.isEmpty())
+        return QString();
+
+    QString tuple=(dapp.isEmpty() ? dport : dapp)+QChar(' ')+dst+QChar(' ')+
+                  (sapp.isEmpty() ? sport : sapp)+QChar(' ')+src;
+
+    if("in"==direction && !interfaceIn.isEmpty())
+        tuple+=QChar(' ')+direction+QChar('_')+interfaceIn;
+    else if("out"==direction && !interfaceOut.isEmpty())
+        tuple+=QChar(' ')+direction+QChar('_')+interfaceOut;
+    return tuple;
+}
+
+bool State::load(int fields)
+{
+    if(fields&(FIELD_STATUS|FIELD_DEFAULTS|FIELD_MODULES))
+    {
+        QMap<QString, QString> config;
+
+        if(!readConfig(UFW_DEFAULTS_FILE, config) || !readConfig(UFW_CONF_FILE, config))
+            return false;
+
+        enabled="yes"==config["enabled"];
+        incoming=toPolicy(config["default_input_policy"]);
+        outgoing=toPolicy(config["default_output_policy"]);
+        logLevel=config["loglevel"];
+        ipv6=config["ipv6"];
+        modules=config["ipt_modules"];
+    }
+
+    if(fields&FIELD_RULES)
+    {
+        bool oldLocation=useOldLocation();
+
+        rules.clear();
+        if(!readRules(oldLocation ? UFW_OLD_RULES_FILE : UFW_RULES_FILE, false) ||
+           !readRules(oldLocation ? UFW_OLD_RULES6_FILE : UFW_RULES6_FILE, true))
+            return false;
+
+        // Remove duplicate application rules - as per getRulesList() in kcm_ufw_helper.py
+        QSet<QString>         appTuples;
+        QList<Rule>::Iterator it(rules.begin());
+
+        while(it!=rules.end())
+        {
+            QString tuple=(*it).appTuple();
+
+            if(!tuple.isEmpty())
+            {
+                if(appTuples.contains(tuple))
+                {
+                    it=rules.erase(it);
+                    continue;
+                }
+                appTuples.insert(tuple);
+            }
+            ++it;
+        }
+    }
+
+    return true;
+}
+
+// Parse tuple comments, as per UFWBackendIptables._read_rules()
+//   ### tuple ### <action>[_<logtype>] <proto> <dport> <dst> <sport> <src> [<dapp> <sapp>] [<direction>[_<iface>]]
+bool State::readRules(const QString &fileName, bool v6)
+{
+    QFile file(fileName);
+
+    if(!file.exists())
+        return !v6; // user6.rules is optional
+    if(!file.open(QIODevice::ReadOnly|QIODevice::Text))
+        return false;
+
+    while(!file.atEnd())
+    {
+        QByteArray line=file.readLine();
+
+        if(!line.startsWith(TUPLE_PREFIX))
+            continue;
+
+        QStringList parts=QString::fromUtf8(line.mid(sizeof(TUPLE_PREFIX)-1)).split(QRegExp("\\s+"), QString::SkipEmptyParts);
+
+        // Newer UFW versions may append a comment - we dont use this
+        if(!parts.isEmpty() && parts.last().startsWith("comment="))
+            parts.removeLast();
+
+        if(parts.count()<6 || parts.count()>9)
+            continue;
+
+        Rule    rule;
+        QString action=parts[0];
+        int     pos;
+
+        if(action.startsWith("route:"))
+            action=action.mid(6);
+
+        pos=action.indexOf('_');
+        if(-1!=pos)
+        {
+            rule.logtype=action.mid(pos+1);
+            action=action.left(pos);
+        }
+
+        rule.action=action;
+        rule.protocol=parts[1];
+        rule.dport=parts[2];
+        rule.dst=parts[3];
+        rule.sport=parts[4];
+        rule.src=parts[5];
+        rule.direction="in";
+        rule.v6=v6;
+
+        if(7==parts.count() || 9==parts.count())
+        {
+            QString dir=parts.last();
+
+            pos=dir.indexOf('_');
+            if(-1==pos)
+                rule.direction=dir;
+            else
+            {
+                rule.direction=dir.left(pos);
+                if("in"==rule.direction)
+                    rule.interfaceIn=dir.mid(pos+1);
+                else
+                    rule.interfaceOut=dir.mid(pos+1);
+            }
+        }
+
+        if(parts.count()>=8)
+        {
+            rule.dapp=unescapeApp(parts[6]);
+            rule.sapp=unescapeApp(parts[7]);
+        }
+
+        rules.append(rule);
+    }
+
+    return true;
+}
+
+// The state, as last read from the UFW files when these had the fingerprint 'fp'. The helper exits shortly after its
+// last action, so this saves parsing the files again each time that it is started.
+bool State::readCache(const QByteArray &fp)
+{
+    QFile file(CACHE_FILE);
+
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32     magic,
+                version,
+                count;
+    QByteArray  storedFp;
+
+    stream >> magic >> version >> storedFp;
+    if(CACHE_MAGIC!=magic || CACHE_VERSION!=version || storedFp!=fp)
+        return false;
+
+    stream >> enabled >> incoming >> outgoing >> logLevel >> ipv6 >> modules >> count;
+    rules.clear();
+    for(quint32 i=0; i<count && QDataStream::Ok==stream.status(); ++i)
+    {
+        Rule rule;
+
+        stream >> rule.action >> rule.direction >> rule.dapp >> rule.sapp >> rule.dport >> rule.sport
+               >> rule.protocol >> rule.dst >> rule.src >> rule.interfaceIn >> rule.interfaceOut >> rule.logtype
+               >> rule.v6;
+        rules.append(rule);
+    }
+    return QDataStream::Ok==stream.status();
+}
+
+void State::writeCache(const QByteArray &fp) const
+{
+    QFile file(CACHE_FILE);
+
+    QDir().mkpath(STATE_DIR);
+    if(!file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream                stream(&file);
+    QList<Rule>::ConstIterator it(rules.constBegin()),
+                               end(rules.constEnd());
+
+    stream << (quint32)CACHE_MAGIC << (quint32)CACHE_VERSION << fp
+           << enabled << incoming << outgoing << logLevel << ipv6 << modules << (quint32)rules.count();
+    for(; it!=end; ++it)
+        stream << (*it).action << (*it).direction << (*it).dapp << (*it).sapp << (*it).dport << (*it).sport
+               << (*it).protocol << (*it).dst << (*it).src << (*it).interfaceIn << (*it).interfaceOut << (*it).logtype
+               << (*it).v6;
+    file.close();
+    // The rules are only readable via the helper
+    file.setPermissions(QFile::ReadOwner|QFile::WriteOwner);
+}
+
+// Addresses and ports of 'any' are sent as empty strings - as the KCM displays these
+static QString any(const QString &str)
+{
+    return "any"==str || "0.0.0.0/0"==str || "::/0"==str ? QString() : str;
+}
+
+QByteArray State::toWire(int fields) const
+{
+    Wire::Encoder encoder;
+
+    if(fields&FIELD_STATUS)
+    {
+        QByteArray  payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+
+        stream << (quint8)enabled;
+        encoder.addSection(Wire::SECTION_STATUS, payload);
+    }
+
+    if(fields&FIELD_DEFAULTS)
+    {
+        QByteArray  payload;
+        QDataStream stream(&payload, QIODevice::WriteOnly);
+
+        stream << Wire::toCode(Wire::policies, incoming) << Wire::toCode(Wire::policies, outgoing)
+               << Wire::toCode(Wire::logLevels, logLevel) << (quint8)("yes"==ipv6);
+        encoder.addSection(Wire::SECTION_DEFAULTS, payload);
+    }
+
+    if(fields&FIELD_RULES)
+    {
+        QByteArray                 payload;
+        QDataStream                stream(&payload, QIODevice::WriteOnly);
+        QList<Rule>::ConstIterator it(rules.constBegin()),
+                                   end(rules.constEnd());
+
+        stream << (quint32)rules.count();
+        for(; it!=end; ++it)
+            stream << Wire::toCode(Wire::policies, (*it).action)
+                   << (quint8)(("in"==(*it).direction ? Wire::RULE_INCOMING : 0)|((*it).v6 ? Wire::RULE_V6 : 0))
+                   << Wire::toCode(Wire::protocols, (*it).protocol)
+                   << Wire::toCode(Wire::loggings, (*it).logtype)
+                   << encoder.string((*it).dapp)
+                   << encoder.string((*it).sapp)
+                   << encoder.string(any((*it).dport))
+                   << encoder.string(any((*it).sport))
+                   << encoder.string(any((*it).dst))
+                   << encoder.string(any((*it).src))
+                   << encoder.string((*it).interfaceIn)
+                   << encoder.string((*it).interfaceOut);
+        encoder.addSection(Wire::SECTION_RULES, payload);
+    }
+
+    if(fields&FIELD_MODULES)
+    {
+        QByteArray                 payload;
+        QDataStream                stream(&payload, QIODevice::WriteOnly);
+        QStringList                mods=modules.split(' ', QString::SkipEmptyParts);
+        QStringList::ConstIterator it(mods.constBegin()),
+                                   end(mods.constEnd());
+
+        stream << (quint32)mods.count();
+        for(; it!=end; ++it)
+            stream << encoder.string(*it);
+        encoder.addSection(Wire::SECTION_MODULES, payload);
+    }
+
+    return encoder.data();
+}
+
+}
@@ -0,0 +1,112 @@
+#ifndef UFW_STATE_H
+#define UFW_STATE_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+namespace UFW
+{
+
+//
+// Reads the current UFW state directly from its configuration files. This is the same information as returned by
+// 'kcm_ufw_helper.py --status --defaults --list --modules', but without the cost of starting python and
+// loading the UFW backend. The state is sent to the KCM using the binary format in common/wire.h
+class State
+{
+    public:
+
+    // Keep in sync with Profile::Fields
+    enum Fields
+    {
+        FIELD_RULES    = 0x01,
+        FIELD_DEFAULTS = 0x02,
+        FIELD_MODULES  = 0x04,
+        FIELD_STATUS   = 0x08,
+
+        FIELD_ALL      = FIELD_RULES|FIELD_DEFAULTS|FIELD_MODULES|FIELD_STATUS
+    };
+
+    struct Rule
+    {
+        Rule() : v6(false) { }
+
+        QString appTuple() const;
+
+        bool operator==(const Rule &o) const
+        {
+            return action==o.action && direction==o.direction && dapp==o.dapp && sapp==o.sapp &&
+                   dport==o.dport && sport==o.sport && protocol==o.protocol && dst==o.dst && src==o.src &&
+                   interfaceIn==o.interfaceIn && interfaceOut==o.interfaceOut && logtype==o.logtype && v6==o.v6;
+        }
+
+        QString action,
+                direction,
+                dapp,
+                sapp,
+                dport,
+                sport,
+                protocol,
+                dst,
+                src,
+                interfaceIn,
+                interfaceOut,
+                logtype;
+        bool    v6;
+    };
+
+    // Ruleset generation - incremented each time the UFW files are seen to have changed. Generations start at 1.
+    static quint64    generation();
+    // Inode, size, and modification time of the UFW files, or of the given files
+    static QByteArray fingerprint();
+    static QByteArray fingerprint(const QStringList &files);
+
+    State() : enabled(false) { }
+
+    bool       load(int fields);
+    bool       readCache(const QByteArray &fp);
+    void       writeCache(const QByteArray &fp) const;
+    QByteArray toWire(int fields) const;
+
+    private:
+
+    bool       readRules(const QString &fileName, bool v6);
+
+    public:
+
+    bool        enabled;
+    QString     incoming,
+                outgoing,
+                logLevel,
+                ipv6,
+                modules;
+    QList<Rule> rules;
+};
+
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "stats.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QTextStream>
+#include <QtCore/QVariantList>
+
+namespace UFW
+{
+
+#define STATS_MAGIC   0x4b55544d // "KUTM"
+#define STATS_VERSION 1
+
+QString Stats::phaseName(Phase p)
+{
+    switch(p)
+    {
+        case PHASE_SPAWN:     return "spawn";
+        case PHASE_BACKEND:   return "backend";
+        case PHASE_RELOAD:    return "reload";
+        case PHASE_SERIALIZE: return "serialize";
+        case PHASE_MARSHAL:   return "marshal";
+        default:
+        case PHASE_TOTAL:     return "total";
+    }
+}
+
+void Stats::Histogram::add(qint64 us)
+{
+    int bucket=0;
+
+    for(quint64 v=us; v && bucket<BUCKET_COUNT-1; v>>=1)
+        ++bucket;
+
+    ++count;
+    total+=us;
+    if((quint64)us>max)
+        max=us;
+    ++buckets[bucket];
+}
+
+void Stats::Histogram::merge(const Histogram &o)
+{
+    count+=o.count;
+    total+=o.total;
+    if(o.max>max)
+        max=o.max;
+    for(int b=0; b<BUCKET_COUNT && b<o.buckets.count(); ++b)
+        buckets[b]+=o.buckets[b];
+}
+
+void Stats::record(const QString &cmd, const Timings &timings)
+{
+    QMap<QString, QVector<Histogram> >::Iterator it=commands.find(cmd);
+
+    if(it==commands.end())
+        it=commands.insert(cmd, QVector<Histogram>(PHASE_COUNT));
+
+    for(int i=0; i<PHASE_COUNT; ++i)
+        if(timings.usecs[i]>=0)
+            (*it)[i].add(timings.usecs[i]);
+}
+
+// Number of times that a command has been recorded
+quint64 Stats::count(const QString &cmd) const
+{
+    QMap<QString, QVector<Histogram> >::ConstIterator it=commands.constFind(cmd);
+
+    return it==commands.constEnd() ? 0 : (*it)[PHASE_TOTAL].count;
+}
+
+// Add the histograms saved in 'fileName' to those held
+bool Stats::load(const QString &fileName)
+{
+    QFile file(fileName);
+
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32     magic,
+                version,
+                phases,
+                buckets,
+                count;
+
+    stream >> magic >> version >> phases >> buckets >> count;
+    if(STATS_MAGIC!=magic || STATS_VERSION!=version || PHASE_COUNT!=phases || BUCKET_COUNT!=buckets ||
+       QDataStream::Ok!=stream.status())
+        return false;
+
+    QMap<QString, QVector<Histogram> > saved;
+
+    for(quint32 i=0; i<count && QDataStream::Ok==stream.status(); ++i)
+    {
+        QString            cmd;
+        QVector<Histogram> histograms(PHASE_COUNT);
+
+        stream >> cmd;
+        for(int p=0; p<PHASE_COUNT; ++p)
+            stream >> histograms[p].count >> histograms[p].total >> histograms[p].max >> histograms[p].buckets;
+        saved.insert(cmd, histograms);
+    }
+
+    // Only merge once all have been read, so that a damaged file is ignored
+    if(QDataStream::Ok!=stream.status())
+        return false;
+
+    QMap<QString, QVector<Histogram> >::ConstIterator it(saved.constBegin()),
+                                                      end(saved.constEnd());
+
+    for(; it!=end; ++it)
+    {
+        QMap<QString, QVector<Histogram> >::Iterator cmd=commands.find(it.key());
+
+        if(cmd==commands.end())
+            commands.insert(it.key(), it.value());
+        else
+            for(int p=0; p<PHASE_COUNT; ++p)
+                (*cmd)[p].merge(it.value()[p]);
+    }
+    return true;
+}
+
+bool Stats::save(const QString &fileName) const
+{
+    QFile file(fileName);
+
+    QDir().mkpath(QFileInfo(file).absolutePath());
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream                                       stream(&file);
+    QMap<QString, QVector<Histogram> >::ConstIterator it(commands.constBegin()),
+                                                      end(commands.constEnd());
+
+    stream << (quint32)STATS_MAGIC << (quint32)STATS_VERSION << (quint32)PHASE_COUNT << (quint32)BUCKET_COUNT
+           << (quint32)commands.count();
+    for(; it!=end; ++it)
+    {
+        stream << it.key();
+        for(int p=0; p<PHASE_COUNT; ++p)
+            stream << it.value()[p].count << it.value()[p].total << it.value()[p].max << it.value()[p].buckets;
+    }
+    file.close();
+    file.setPermissions(QFile::ReadOwner|QFile::WriteOwner|QFile::ReadGroup|QFile::ReadOther);
+    return QDataStream::Ok==stream.status();
+}
+
+QVariantMap Stats::toVariant() const
+{
+    QVariantMap                                       map;
+    QMap<QString, QVector<Histogram> >::ConstIterator it(commands.constBegin()),
+                                                      end(commands.constEnd());
+
+    for(; it!=end; ++it)
+    {
+        QVariantMap phases;
+
+        for(int i=0; i<PHASE_COUNT; ++i)
+        {
+            const Histogram &h=it.value()[i];
+
+            if(0==h.count)
+                continue;
+
+            QVariantMap  phase;
+            QVariantList buckets;
+
+            for(int b=0; b<BUCKET_COUNT; ++b)
+                buckets.append(h.buckets[b]);
+            phase["count"]=h.count;
+            phase["total"]=h.total;
+            phase["max"]=h.max;
+            phase["buckets"]=buckets;
+            phases[phaseName((Phase)i)]=phase;
+        }
+        map[it.key()]=phases;
+    }
+    return map;
+}
+
+// One line per command and phase - "<cmd> <phase> count=<n> mean=<us> max=<us> <bucket>:<n> ..."
+QByteArray Stats::toText() const
+{
+    QByteArray                                        text;
+    QTextStream                                       stream(&text, QIODevice::WriteOnly);
+    QMap<QString, QVector<Histogram> >::ConstIterator it(commands.constBegin()),
+                                                      end(commands.constEnd());
+
+    for(; it!=end; ++it)
+        for(int i=0; i<PHASE_COUNT; ++i)
+        {
+            const Histogram &h=it.value()[i];
+
+            if(0==h.count)
+                continue;
+
+            stream << it.key() << ' ' << phaseName((Phase)i) << " count=" << h.count << " mean=" << (h.total/h.count)
+                   << " max=" << h.max;
+            for(int b=0; b<BUCKET_COUNT; ++b)
+                if(h.buckets[b])
+                    stream << ' ' << (b ? (1ULL<<b) : 1ULL) << ':' << h.buckets[b];
+            stream << '\n';
+        }
+    stream.flush();
+    return text;
+}
+
+}
@@ -0,0 +1,104 @@
+#ifndef UFW_STATS_H
+#define UFW_STATS_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMap>
+#include <QtCore/QString>
+#include <QtCore/QVariantMap>
+#include <QtCore/QVector>
+
+namespace UFW
+{
+
+//
+// Per-command latency histograms. Times are in microseconds, and each histogram bucket n holds the count of times in
+// the range [2^(n-1), 2^n). The helper exits shortly after its last action, so the histograms are saved after each
+// command - and those saved by previous instances are merged in by load().
+class Stats
+{
+    public:
+
+    enum Phase
+    {
+        PHASE_SPAWN,     // Starting, or connecting to, the python helper
+        PHASE_BACKEND,   // UFW backend work within the python helper
+        PHASE_RELOAD,    // Reloading the firewall
+        PHASE_SERIALIZE, // Reading the UFW state, and encoding the reply
+        PHASE_MARSHAL,   // Marshalling the KAuth reply - only sampled, so has fewer counts than the others
+        PHASE_TOTAL,
+
+        PHASE_COUNT
+    };
+
+    enum Constants
+    {
+        BUCKET_COUNT = 32
+    };
+
+    // Phase times for a single command - phases that did not occur are -1
+    struct Timings
+    {
+        Timings()                                 { clear(); }
+
+        void clear()                              { for(int i=0; i<PHASE_COUNT; ++i) usecs[i]=-1; }
+        void add(Phase p, qint64 us)              { usecs[p]=(usecs[p]<0 ? 0 : usecs[p])+us; }
+        void add(Phase p, const QElapsedTimer &t) { add(p, t.nsecsElapsed()/1000); }
+
+        qint64 usecs[PHASE_COUNT];
+    };
+
+    static QString phaseName(Phase p);
+
+    void        record(const QString &cmd, const Timings &timings);
+    void        clear()   { commands.clear(); }
+    quint64     count(const QString &cmd) const;
+    bool        load(const QString &fileName);
+    bool        save(const QString &fileName) const;
+    QVariantMap toVariant() const;
+    QByteArray  toText() const;
+
+    private:
+
+    struct Histogram
+    {
+        Histogram() : count(0), total(0), max(0), buckets(BUCKET_COUNT, 0) { }
+
+        void add(qint64 us);
+        void merge(const Histogram &o);
+
+        quint64          count,
+                         total,
+                         max;
+        QVector<quint32> buckets;
+    };
+
+    QMap<QString, QVector<Histogram> > commands;
+};
+
+}
+
+#endif
@@ -76,6 +76,7 @@ const QList<Entry> & get()
                 }
             }
         qSort(profiles);
+        init=true;
     }
         
     return profiles;
@@ -28,6 +28,7 @@
 #include "types.h"
 #include "strings.h"
 #include "statusbox.h"
+#include "portnames.h"
 #include <KDE/KAboutData>
 #include <KDE/KLocale>
 #include <KDE/KMessageBox>
@@ -176,6 +177,26 @@ static void addModule(QTreeWidget *tree, const KernelModule &mod)
     }
 }
 
+// Commands that refer to rules by position, or replace the rules
+static bool changesRules(const QVariantMap &args)
+{
+    QString cmd=args["cmd"].toString();
+
+    return "addRules"==cmd || "editRule"==cmd || "removeRule"==cmd || "moveRule"==cmd || "reorder"==cmd ||
+           "setProfile"==cmd || "reset"==cmd || ("setDefaults"==cmd && args["ipv6"].toBool());
+}
+
+static QString defaultsXml(const QVariantMap &defaults)
+{
+    QString                    xml("<defaults");
+    QVariantMap::ConstIterator it(defaults.constBegin()),
+                               end(defaults.constEnd());
+
+    for(; it!=end; ++it)
+        xml+=QChar(' ')+it.key()+QString("=\"")+it.value().toString()+QChar('\"');
+    return xml+QString(" />");
+}
+
 static inline QString profileFileName(const QString &name)
 {
     return KGlobal::dirs()->saveLocation("data", FOLDER"/", KStandardDirs::NoDuplicates)+name+EXTENSION;
@@ -190,8 +211,11 @@ Kcm::Kcm(QWidget *parent, const QVariantList&)
    : KCModule(UfwFactory::componentData(), parent)
    , addDialog(0L)
    , editDialog(0L)
+   , rulesGeneration(0)
    , moveToPos(0)
+   , moveToCount(0)
    , logViewer(0L)
+   , requestActive(false)
 {
     setButtons(Help|Default);
 
@@ -201,6 +225,9 @@ Kcm::Kcm(QWidget *parent, const QVariantList&)
     about->addAuthor(ki18n("Craig Drummond"), ki18n("Developer and maintainer"), "craig.p.drummond@gmail.com");
     setAboutData(about);
 
+    // The port name tables use i18n() and the application profiles, so are built here - on the GUI thread
+    PortNames::get();
+
     setupUi(this);
     setupWidgets();
     setupActions();
@@ -230,11 +257,9 @@ bool Kcm::addRules(const QList<Rule> &rules)
         args["xml"+QString().setNum(i)]=(*it).toXml();
     }
 
-    modifyAction.setArguments(args);
-    statusLabel->setText(rules.size()>1 ? i18n("Adding rules...") : i18n("Adding rule..."));
-    emit status(statusLabel->fullText());
-    blocker->setActive(true);
-    modifyAction.execute();
+    QString msg(rules.size()>1 ? i18n("Adding rules...") : i18n("Adding rule..."));
+    queue(args, msg);
+    emit status(msg);
     return true;
 }
 
@@ -258,11 +283,9 @@ void Kcm::editRule(Rule rule)
         args["cmd"]="editRule";
         rule.setPosition((unsigned int)item->data(0, Qt::UserRole).toUInt());
         args["xml"]=rule.toXml();
-        modifyAction.setArguments(args);
-        statusLabel->setText(i18n("Updating rule..."));
-        emit status(statusLabel->fullText());
-        blocker->setActive(true);
-        modifyAction.execute();
+        QString msg(i18n("Updating rule..."));
+        queue(args, msg);
+        emit status(msg);
     }
 }
 
@@ -284,10 +307,7 @@ void Kcm::defaults()
     {
         QVariantMap args;
         args["cmd"]="reset";
-        modifyAction.setArguments(args);
-        statusLabel->setText(i18n("Resetting to system default settings..."));
-        blocker->setActive(true);
-        modifyAction.execute();
+        queue(args, i18n("Resetting to system default settings..."));
     }
 }
 
@@ -296,10 +316,126 @@ void Kcm::queryStatus(bool readDefaults, bool listProfiles)
     QVariantMap args;
     args["defaults"]=readDefaults;
     args["profiles"]=listProfiles;
-    queryAction.setArguments(args);
-    statusLabel->setText(i18n("Querying firewall status..."));
-    blocker->setActive(true);
-    queryAction.execute();
+    queue(args, i18n("Querying firewall status..."));
+}
+
+// Requests are sent one at a time, in order. Queued requests that would be overwritten by a newer one are
+// combined - e.g. several changes to the default policies become a single setDefaults, and repeated
+// queries become one.
+void Kcm::queue(const QVariantMap &args, const QString &msg)
+{
+    Request request(args, msg);
+    QString cmd=args["cmd"].toString();
+
+    if(!requests.isEmpty() && (request.isQuery() || "setDefaults"==cmd || "setStatus"==cmd || "setModules"==cmd))
+    {
+        QList<Request>::Iterator it(requests.begin()),
+                                 end(requests.end());
+
+        for(; it!=end; ++it)
+            // Read with value(), as operator[] would add an empty "cmd" to a query - which would then no longer be one
+            if((*it).isQuery()==request.isQuery() && (*it).args.value("cmd").toString()==cmd)
+            {
+                // Don't move an IPv6 change in front of other requests, as this may remove rules
+                if(changesRules(args) && it+1!=end)
+                    break;
+
+                if(request.isQuery())
+                {
+                    (*it).args["defaults"]=(*it).args.value("defaults").toBool() || args["defaults"].toBool();
+                    (*it).args["profiles"]=(*it).args.value("profiles").toBool() || args["profiles"].toBool();
+                }
+                else if("setDefaults"==cmd)
+                {
+                    QVariantMap                defaults=(*it).args.value("defaults").toMap(),
+                                               newDefaults=args["defaults"].toMap();
+                    QVariantMap::ConstIterator dIt(newDefaults.constBegin()),
+                                               dEnd(newDefaults.constEnd());
+
+                    for(; dIt!=dEnd; ++dIt)
+                        defaults[dIt.key()]=dIt.value();
+                    (*it).args["defaults"]=defaults;
+                    (*it).args["ipv6"]=(*it).args.value("ipv6").toBool() || args["ipv6"].toBool();
+                    (*it).msg=msg;
+                }
+                else
+                    *it=request;
+                updateBlocker();
+                return;
+            }
+    }
+
+    requests.append(request);
+    updateBlocker();
+    QTimer::singleShot(0, this, SLOT(processQueue()));
+}
+
+bool Kcm::isQueued(const QString &cmd) const
+{
+    QList<Request>::ConstIterator it(requests.constBegin()),
+                                  end(requests.constEnd());
+
+    for(; it!=end; ++it)
+        if((*it).args["cmd"].toString()==cmd)
+            return true;
+    return false;
+}
+
+// Only block changes to the rules whilst a request that changes them is pending - as these refer to rules by
+// position. Everything else may be queued.
+void Kcm::updateBlocker()
+{
+    bool block=requestActive && changesRules(currentRequest.args);
+
+    QList<Request>::ConstIterator it(requests.constBegin()),
+                                  end(requests.constEnd());
+
+    for(; it!=end && !block; ++it)
+        block=changesRules((*it).args);
+    blocker->setActive(block);
+}
+
+void Kcm::processQueue()
+{
+    if(requestActive)
+        return;
+
+    if(requests.isEmpty())
+    {
+        if(logViewer)
+            logViewer->resumeFollow();
+        return;
+    }
+
+    // The helper only runs one action at a time, so pause the log viewer's requests until the queue is empty.
+    if(logViewer && logViewer->pauseFollow())
+        return;
+
+    currentRequest=requests.takeFirst();
+    requestActive=true;
+
+    QVariantMap args=currentRequest.args;
+    QString     cmd=args["cmd"].toString();
+
+    if("addRules"==cmd || "editRule"==cmd || "removeRule"==cmd || "moveRule"==cmd || "reorder"==cmd)
+        args["generation"]=rulesGeneration;
+    else if(currentRequest.isQuery() && rulesGeneration)
+        args["ifChangedSince"]=rulesGeneration;
+    else if("setDefaults"==cmd)
+        args["xml"]=defaultsXml(args.take("defaults").toMap());
+
+    statusLabel->setText(currentRequest.msg);
+    updateBlocker();
+    if(currentRequest.isQuery())
+    {
+        queryAction.setArguments(args);
+        queryAction.execute();
+    }
+    else
+    {
+        modifyAction.setArguments(args);
+        modifyAction.execute();
+    }
 }
 
 void Kcm::setStatus()
@@ -307,10 +443,7 @@ void Kcm::setStatus()
     QVariantMap args;
     args["cmd"]="setStatus";
     args["status"]=ufwEnabled->isChecked();
-    modifyAction.setArguments(args);
-    statusLabel->setText(ufwEnabled->isChecked() ? i18n("Enabling the firewall...") : i18n("Disabling the firewall..."));
-    blocker->setActive(true);
-    modifyAction.execute();
+    queue(args, ufwEnabled->isChecked() ? i18n("Enabling the firewall...") : i18n("Disabling the firewall..."));
 }
 
 void Kcm::setIpV6()
@@ -334,14 +467,13 @@ void Kcm::setIpV6()
         }
     }
 
-    QVariantMap args;
+    QVariantMap args,
+                defaults;
+    defaults["ipv6"]=ipv6Enabled->isChecked() ? "yes" : "no";
     args["cmd"]="setDefaults";
     args["ipv6"]=true;
-    args["xml"]=QString("<defaults ipv6=\"")+QString(ipv6Enabled->isChecked() ? "yes" : "no")+QString("\" />");
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Setting firewall IPv6 support..."));
-    blocker->setActive(true);
-    modifyAction.execute();
+    args["defaults"]=defaults;
+    queue(args, i18n("Setting firewall IPv6 support..."));
 }
 
 void Kcm::createRules()
@@ -380,10 +512,7 @@ void Kcm::removeRule()
         args["index"]=QString().setNum((unsigned int)item->data(0, Qt::UserRole).toUInt())/*+
                       QChar(':')+
                       currentRules.at((unsigned int)item->data(0, Qt::UserRole).toUInt()-1).getHash()*/;
-        modifyAction.setArguments(args);
-        statusLabel->setText(i18n("Removing rule from firewall..."));
-        blocker->setActive(true);
-        modifyAction.execute();
+        queue(args, i18n("Removing rule from firewall..."));
     }
 }
 
@@ -402,60 +531,87 @@ void Kcm::moveTo(const QTreeWidgetItem *item)
     if(blocker->isActive())
         return;
 
-    QList<QTreeWidgetItem*> items=ruleList->selectedItems();
+    QList<QTreeWidgetItem*>           items=ruleList->selectedItems();
+    QList<QTreeWidgetItem*>::Iterator it(items.begin()),
+                                      end(items.end());
+    QList<unsigned int>               from;
+
+    for(; it!=end; ++it)
+        from.append((*it)->data(0, Qt::UserRole).toUInt());
 
-    moveRule(items.count() ? items.first()->data(0, Qt::UserRole).toUInt() : 0L,
-             item ? item->data(0, Qt::UserRole).toUInt() : ruleList->topLevelItemCount()+1);
+    moveRules(from, item ? item->data(0, Qt::UserRole).toUInt() : ruleList->topLevelItemCount()+1);
 }
 
 void Kcm::setLogLevel()
 {
-    QVariantMap args;
+    QVariantMap args,
+                defaults;
+    defaults["loglevel"]=toString((Types::LogLevel)ufwLoggingLevel->currentIndex());
     args["cmd"]="setDefaults";
-    args["xml"]=QString("<defaults loglevel=\"")+toString((Types::LogLevel)ufwLoggingLevel->currentIndex())+QString("\" />");
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Setting firewall log level..."));
-    blocker->setActive(true);
-    modifyAction.execute();
+    args["defaults"]=defaults;
+    queue(args, i18n("Setting firewall log level..."));
 }
 
 void Kcm::setDefaultIncomingPolicy()
 {
-    QVariantMap args;
+    QVariantMap args,
+                defaults;
+    defaults["incoming"]=toString((Types::Policy)defaultIncomingPolicy->currentIndex());
     args["cmd"]="setDefaults";
-    args["xml"]=QString("<defaults incoming=\"")+toString((Types::Policy)defaultIncomingPolicy->currentIndex())+QString("\" />");
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Setting firewall default incoming policy..."));
-    blocker->setActive(true);
-    modifyAction.execute();
+    args["defaults"]=defaults;
+    queue(args, i18n("Setting firewall default incoming policy..."));
 }
 
 void Kcm::setDefaultOutgoingPolicy()
 {
-    QVariantMap args;
+    QVariantMap args,
+                defaults;
+    defaults["outgoing"]=toString((Types::Policy)defaultOutgoingPolicy->currentIndex());
     args["cmd"]="setDefaults";
-    args["xml"]=QString("<defaults outgoing=\"")+toString((Types::Policy)defaultOutgoingPolicy->currentIndex())+QString("\" />");
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Setting firewall default outgoing policy..."));
-    blocker->setActive(true);
-    modifyAction.execute();
+    args["defaults"]=defaults;
+    queue(args, i18n("Setting firewall default outgoing policy..."));
 }
 
 void Kcm::queryPerformed(ActionReply reply)
 {
-    QByteArray response=reply.succeeded() ? reply.data()["response"].toByteArray() : QByteArray();
+    QByteArray response=reply.succeeded() ? reply.data()["response"].toByteArray() : QByteArray(),
+               state=reply.succeeded() ? reply.data()["state"].toByteArray() : QByteArray();
 
-    blocker->setActive(false);
-    if(!response.isEmpty())
+    requestActive=false;
+    updateBlocker();
+    QTimer::singleShot(0, this, SLOT(processQueue()));
+    // A "notModified" reply has no state, as we already have the current generation
+    if(!state.isEmpty() || !response.isEmpty())
     {
-        Profile profile(response);
-
-        setStatus(profile);
-        setDefaults(profile);
-        setModules(profile);
+        // The helper sends its state in binary form, but falls back to XML from the python helper
+        Profile profile=state.isEmpty() ? Profile(response) : Profile::fromWire(state);
+
+        // Don't reset controls whose newer values are still queued
+        if(!isQueued("setStatus"))
+            setStatus(profile);
+        if(!isQueued("setDefaults"))
+            setDefaults(profile);
+        if(!isQueued("setModules"))
+            setModules(profile);
         setRules(profile);
     }
 
+    if(reply.succeeded())
+    {
+        // Only apply a delta if it is against the rules we have - otherwise re-read everything.
+        if(reply.data().contains("delta"))
+        {
+            if(reply.data()["baseGeneration"].toULongLong()!=rulesGeneration)
+            {
+                rulesGeneration=0;
+                queryStatus(false, false);
+                return;
+            }
+            applyDelta(reply.data()["delta"].toMap());
+        }
+        rulesGeneration=reply.data()["generation"].toULongLong();
+    }
+
     showCurrentStatus();
 
     if(reply.succeeded() && reply.data().contains("profiles"))
@@ -466,7 +622,9 @@ void Kcm::modifyPerformed(ActionReply reply)
 {
     QString cmd(reply.data()["cmd"].toString());
 
-    blocker->setActive(false);
+    requestActive=false;
+    updateBlocker();
+    QTimer::singleShot(0, this, SLOT(processQueue()));
     emit status(QString()); // Clear add dialog status...
     if(reply.succeeded())
     {
@@ -488,14 +646,19 @@ void Kcm::modifyPerformed(ActionReply reply)
         else if("removeRule"==cmd)
             KMessageBox::error(this, i18n("<p>Failed to remove rule.</p><p><i>%1</i></p>",
                                           QString(reply.data()["response"].toByteArray())));
+        else if("batch"==cmd)
+            KMessageBox::error(this, i18n("<p>Failed to modify firewall, no changes have been made.</p><p><i>%1</i></p>",
+                                          QString(reply.data()["response"].toByteArray())));
        else if("saveProfile"==cmd)
             KMessageBox::error(this, i18n("<p>Failed to save profile.</p><p><i>%1</i></p>",
                                           QString(reply.data()["name"].toString())));
        else if("deleteProfile"==cmd)
             KMessageBox::error(this, i18n("<p>Failed to delete profile.</p><p><i>%1</i></p>",
                                           QString(reply.data()["name"].toString())));
-        // Refresh list...
+        // Refresh list... Any queued requests were made against the state prior to the failure, so drop these.
         moveToPos=0;
+        requests.clear();
+        rulesGeneration=0; // Force a full refresh - the controls may not match the firewall
         queryStatus(true, false);
         showCurrentStatus();
     }
@@ -560,10 +723,7 @@ void Kcm::moduleClicked(QTreeWidgetItem *item, int col)
 
     args["cmd"]="setModules";
     args["xml"]=profile.modulesXml();
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Setting firewall modules..."));
-    blocker->setActive(true);
-    modifyAction.execute();
+    queue(args, i18n("Setting firewall modules..."));
 }
 
 class ProfileNameValidator : public QValidator
@@ -624,11 +784,8 @@ void Kcm::loadProfile(QAction *profile)
             args["rule"+QString().setNum(i)]=(*it).toXml();
     }
 
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Activating firewall profile %1...", profileName(profile)));
     loadedProfile=QString();
-    blocker->setActive(true);
-    modifyAction.execute();
+    queue(args, i18n("Activating firewall profile %1...", profileName(profile)));
 }
 
 void Kcm::removeProfile(QAction *profile)
@@ -649,10 +806,7 @@ void Kcm::removeProfile(QAction *profile)
 
             args["cmd"]="deleteProfile";
             args["name"]=name;
-            modifyAction.setArguments(args);
-            statusLabel->setText(QString("Deleting firewall profile ")+name+"...");
-            blocker->setActive(true);
-            modifyAction.execute();
+            queue(args, QString("Deleting firewall profile ")+name+"...");
         }
         else if(QFile::remove(p.getFileName()))
         {
@@ -741,7 +895,10 @@ void Kcm::deleteMenuShown()
 void Kcm::displayLog()
 {
     if(!logViewer)
+    {
         logViewer=new LogViewer(this);
+        connect(logViewer, SIGNAL(helperReleased()), SLOT(processQueue()));
+    }
     logViewer->showNormal();
 }
 
@@ -859,10 +1016,7 @@ void Kcm::saveProfile(const QString &name, const Profile &profile)
     args["cmd"]="saveProfile";
     args["name"]=name;
     args["xml"]=profile.toXml();
-    modifyAction.setArguments(args);
-    statusLabel->setText(i18n("Saving firewall profile %1...", name));
-    blocker->setActive(true);
-    modifyAction.execute();
+    queue(args, i18n("Saving firewall profile %1...", name));
 }
 
 void Kcm::refreshProfiles(const QMap<QString, QVariant> &profileList)
@@ -1039,21 +1193,78 @@ void Kcm::moveRulePos(int offset)
 
 void Kcm::moveRule(int from, int to)
 {
-    if(blocker->isActive())
+    if(from>0)
+        moveRules(QList<unsigned int>() << from, to);
+}
+
+// Move the rules at the given positions, as a block, to 'to' - which may be one past the last rule. As with moving
+// a single rule, the block is placed before 'to' when moving up, and after it when moving down. The new order of
+// all the rules is sent, so that they are re-written in one go. UFW always keeps IPv6 rules after those for IPv4 (and
+// the helper rejects any other order) - so the block is only moved as far as the first IPv6 rule, or the last IPv4
+// rule. A block with both is placed where these meet.
+void Kcm::moveRules(QList<unsigned int> from, unsigned int to)
+{
+    unsigned int count=ruleList->topLevelItemCount();
+
+    if(blocker->isActive() || from.isEmpty() || 0==to || to>count+1 || count>(unsigned int)currentRules.count())
         return;
 
-    if(from && to && from!=to)
+    qSort(from);
+
+    QSet<unsigned int>  moving=from.toSet();
+    QList<unsigned int> order;
+    int                 v4Count=0;
+    bool                hasV4=false,
+                        hasV6=false;
+
+    if(moving.contains(to))
+        return;
+
+    for(unsigned int i=1; i<=count; ++i)
+        if(!moving.contains(i))
+        {
+            order.append(i);
+            if(!currentRules.at(i-1).getV6())
+                ++v4Count;
+        }
+
+    QList<unsigned int>::ConstIterator it(from.constBegin()),
+                                       end(from.constEnd());
+
+    for(; it!=end; ++it)
+        if(currentRules.at(*it-1).getV6())
+            hasV6=true;
+        else
+            hasV4=true;
+
+    int pos=to>count ? order.count() : order.indexOf(to)+(to>from.first() ? 1 : 0);
+
+    pos=qBound(hasV6 ? v4Count : 0, pos, hasV4 ? v4Count : order.count());
+
+    int first=pos;
+
+    for(it=from.constBegin(); it!=end; ++it)
+        order.insert(pos++, *it);
+
+    QVariantList orderArg;
+    bool         changed=false;
+
+    for(int i=0; i<order.count(); ++i)
     {
-        QVariantMap args;
-        args["cmd"]="moveRule";
-        args["from"]=from;
-        args["to"]=to;
-        moveToPos=to;
-        modifyAction.setArguments(args);
-        statusLabel->setText(i18n("Moving rule in firewall..."));
-        blocker->setActive(true);
-        modifyAction.execute();
+        orderArg.append(order[i]);
+        if(order[i]!=(unsigned int)i+1)
+            changed=true;
     }
+
+    if(!changed)
+        return;
+
+    QVariantMap args;
+    args["cmd"]="reorder";
+    args["order"]=orderArg;
+    moveToPos=first+1;
+    moveToCount=from.count();
+    queue(args, i18np("Moving rule in firewall...", "Moving %1 rules in firewall...", from.count()));
 }
 
 void Kcm::showCurrentStatus()
@@ -1133,6 +1344,7 @@ void Kcm::setupWidgets()
     profilesMenu->addAction(KIcon("document-import"), i18n("Import..."), this, SLOT(importProfile()));
     profilesMenu->addAction(KIcon("document-export"), i18n("Export..."), this, SLOT(exportProfile()));
     profilesButton->setMenu(profilesMenu);
+    ruleList->setSelectionMode(QAbstractItemView::ExtendedSelection);
     ruleList->setDragEnabled(true);
     ruleList->viewport()->setAcceptDrops(true);
     ruleList->setDropIndicatorShown(true);
@@ -1149,19 +1361,13 @@ void Kcm::setupWidgets()
     addModules();
 
     blocker=new Blocker(this);
-    blocker->add(ufwEnabled);
-    blocker->add(ipv6Enabled);
-    blocker->add(ufwLoggingLevel);
-    blocker->add(defaultIncomingPolicy);
-    blocker->add(defaultOutgoingPolicy);
+    // Status, defaults, etc. are queued whilst other requests are in progress - see Kcm::queue()
     blocker->add(addRuleButton);
     blocker->add(editRuleButton);
     blocker->add(removeRuleButton);
     blocker->add(moveRuleUpButton);
     blocker->add(moveRuleDownButton);
-    blocker->add(refreshButton);
     blocker->add(profilesButton);
-    blocker->add(logButton);
 }
 
 void Kcm::setupActions()
@@ -1171,7 +1377,7 @@ void Kcm::setupActions()
 #if KDE_IS_VERSION(4, 5, 90)
     queryAction.setParentWidget(this);
 #endif
-//     queryAction.setExecutesAsync(true);
+    queryAction.setExecutesAsync(true);
     connect(queryAction.watcher(), SIGNAL(actionPerformed(ActionReply)), SLOT(queryPerformed(ActionReply)));
 
     modifyAction=KAuth::Action("org.kde.ufw.modify");
@@ -1179,7 +1385,7 @@ void Kcm::setupActions()
 #if KDE_IS_VERSION(4, 5, 90)
     modifyAction.setParentWidget(this);
 #endif
-//     modifyAction.setExecutesAsync(true);
+    modifyAction.setExecutesAsync(true);
     connect(modifyAction.watcher(), SIGNAL(actionPerformed(ActionReply)), SLOT(modifyPerformed(ActionReply)));
 }
 
@@ -1395,6 +1601,42 @@ void Kcm::setRules(const Profile &profile)
     }
 }
 
+// Update list in place - remove the changed rules, insert their replacements, and renumber those after.
+void Kcm::applyDelta(const QVariantMap &delta)
+{
+    int         position=delta["position"].toInt(),
+                removed=delta["removed"].toInt();
+    QList<Rule> inserted=Profile::fromWire(delta["inserted"].toByteArray()).getRules();
+
+    for(int i=0; i<removed && position<currentRules.count(); ++i)
+    {
+        currentRules.removeAt(position);
+        delete ruleList->takeTopLevelItem(position);
+    }
+
+    QList<Rule>::ConstIterator it(inserted.constBegin()),
+                               end(inserted.constEnd());
+
+    for(int index=position; it!=end; ++it, ++index)
+    {
+        currentRules.insert(index, *it);
+        ruleList->insert(*it, index);
+    }
+
+    for(int index=position; index<ruleList->topLevelItemCount(); ++index)
+        ruleList->topLevelItem(index)->setData(0, Qt::UserRole, index+1);
+
+    if(moveToPos && moveToPos<=(unsigned int)ruleList->topLevelItemCount())
+    {
+        ruleList->clearSelection();
+        for(unsigned int i=moveToPos; i<moveToPos+moveToCount && i<=(unsigned int)ruleList->topLevelItemCount(); ++i)
+            ruleList->topLevelItem(i-1)->setSelected(true);
+    }
+
+    if(!inserted.isEmpty())
+        ruleList->resizeToContents();
+}
+
 QSet<QString> Kcm::modules()
 {
     QSet<QString> mods;
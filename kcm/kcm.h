@@ -96,9 +96,27 @@ class Kcm : public KCModule, public Ui::Ufw
     void          loadMenuShown();
     void          deleteMenuShown();
     void          displayLog();
+    void          processQueue();
 
     private:
 
+    // A queued helper request - queries have no "cmd"
+    struct Request
+    {
+        Request(const QVariantMap &a=QVariantMap(), const QString &m=QString()) : args(a), msg(m) { }
+
+        bool        isQuery() const { return !args.contains("cmd"); }
+
+        QVariantMap args;
+        QString     msg;
+    };
+
+    private:
+
+    void          queue(const QVariantMap &args, const QString &msg);
+    bool          isQueued(const QString &cmd) const;
+    void          updateBlocker();
+
     QString       getNewProfileName(const QString &currentName, bool isImport);
     void          listUserProfiles();
     QAction *     getAction(const QString &name);
@@ -112,6 +130,7 @@ class Kcm : public KCModule, public Ui::Ufw
     void          deleteProfile(const QString &name);
     void          moveRulePos(int offset);
     void          moveRule(int from, int to);
+    void          moveRules(QList<unsigned int> from, unsigned int to);
     void          showCurrentStatus();
     void          setupWidgets();
     void          setupActions();
@@ -120,6 +139,7 @@ class Kcm : public KCModule, public Ui::Ufw
     void          setDefaults(const Profile &profile);
     void          setModules(const Profile &profile);
     void          setRules(const Profile &profile);
+    void          applyDelta(const QVariantMap &delta);
     QSet<QString> modules();
 
     private:
@@ -129,8 +149,10 @@ class Kcm : public KCModule, public Ui::Ufw
     Action                   queryAction,
                              modifyAction;
     QList<Rule>              currentRules;
+    quint64                  rulesGeneration;
     QSet<QString>            otherModules;
-    unsigned int             moveToPos;
+    unsigned int             moveToPos,
+                             moveToCount;
     QMenu                    *loadMenu,
                              *deleteMenu;
     QAction                  *noProfilesAction;
@@ -141,6 +163,9 @@ class Kcm : public KCModule, public Ui::Ufw
     Blocker                  *blocker;
     QSet<QString>            existingProfiles;
     LogViewer                *logViewer;
+    QList<Request>           requests;
+    Request                  currentRequest;
+    bool                     requestActive;
 };
 
 }
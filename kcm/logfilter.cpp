@@ -0,0 +1,419 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logfilter.h"
+#include <KDE/KLocale>
+#include <QtCore/QRegExp>
+#include <arpa/inet.h>
+#include <algorithm>
+
+namespace UFW
+{
+
+#define MAX_PORT 65535
+
+static QStringList tokenize(const QString &expr)
+{
+    QStringList tokens;
+    int         pos=0,
+                len=expr.length();
+
+    while(pos<len)
+    {
+        QChar ch=expr[pos];
+
+        if(ch.isSpace())
+            ++pos;
+        else if('('==ch || ')'==ch)
+        {
+            tokens << QString(ch);
+            ++pos;
+        }
+        else if('='==ch || '!'==ch)
+        {
+            bool two=pos+1<len && '='==expr[pos+1];
+
+            tokens << expr.mid(pos, two ? 2 : 1);
+            pos+=two ? 2 : 1;
+        }
+        else
+        {
+            int start=pos;
+
+            while(pos<len && !expr[pos].isSpace() && '('!=expr[pos] && ')'!=expr[pos] && '='!=expr[pos] &&
+                  '!'!=expr[pos])
+                ++pos;
+            tokens << expr.mid(start, pos-start);
+        }
+    }
+    return tokens;
+}
+
+// Convert an address from a log line, without allocating memory
+static bool toAddress(const char *str, int len, bool &v6, quint8 *bytes)
+{
+    char buffer[INET6_ADDRSTRLEN+1];
+
+    if(len<=0 || len>INET6_ADDRSTRLEN)
+        return false;
+    memcpy(buffer, str, len);
+    buffer[len]='\0';
+    v6=0L!=memchr(buffer, ':', len);
+    return 1==inet_pton(v6 ? AF_INET6 : AF_INET, buffer, bytes);
+}
+
+static bool textMatches(const QList<QByteArray> &texts, const LogField &field)
+{
+    QList<QByteArray>::ConstIterator it(texts.constBegin()),
+                                     end(texts.constEnd());
+
+    for(; it!=end; ++it)
+        if((*it).length()==field.length && 0==qstrnicmp((*it).constData(), field.data, field.length))
+            return true;
+    return false;
+}
+
+static bool rangeLessThan(const QPair<uint, uint> &a, const QPair<uint, uint> &b)
+{
+    return a.first<b.first;
+}
+
+bool LogFilter::compile(const QString &expr, QString &error)
+{
+    nodes.clear();
+    root=-1;
+    tokens=tokenize(expr);
+    token=0;
+    error=QString();
+
+    if(!tokens.isEmpty())
+    {
+        root=parseOr(error);
+        if(root>=0 && token<tokens.count())
+        {
+            error=i18n("Unexpected '%1'", tokens[token]);
+            root=-1;
+        }
+    }
+    tokens.clear();
+    if(root<0)
+        nodes.clear();
+    return error.isEmpty();
+}
+
+int LogFilter::parseOr(QString &error)
+{
+    int left=parseAnd(error);
+
+    while(left>=0 && token<tokens.count() &&
+          (0==tokens[token].compare("or", Qt::CaseInsensitive) || "||"==tokens[token]))
+    {
+        ++token;
+
+        int right=parseAnd(error);
+
+        left=right<0 ? -1 : addNode(NODE_OR, left, right);
+    }
+    return left;
+}
+
+// 'and' is optional - i.e. "src 1.2.3.4 dpt 22" is the same as "src 1.2.3.4 and dpt 22"
+int LogFilter::parseAnd(QString &error)
+{
+    int left=parseNot(error);
+
+    while(left>=0 && token<tokens.count() && ")"!=tokens[token] &&
+          0!=tokens[token].compare("or", Qt::CaseInsensitive) && "||"!=tokens[token])
+    {
+        if(0==tokens[token].compare("and", Qt::CaseInsensitive) || "&&"==tokens[token])
+            ++token;
+
+        int right=parseNot(error);
+
+        left=right<0 ? -1 : addNode(NODE_AND, left, right);
+    }
+    return left;
+}
+
+int LogFilter::parseNot(QString &error)
+{
+    if(token>=tokens.count())
+    {
+        error=i18n("Incomplete filter");
+        return -1;
+    }
+
+    if(0==tokens[token].compare("not", Qt::CaseInsensitive) || "!"==tokens[token])
+    {
+        ++token;
+
+        int child=parseNot(error);
+
+        return child<0 ? -1 : addNode(NODE_NOT, child, -1);
+    }
+
+    if("("==tokens[token])
+    {
+        ++token;
+
+        int child=parseOr(error);
+
+        if(child<0)
+            return -1;
+        if(token>=tokens.count() || ")"!=tokens[token])
+        {
+            error=i18n("Missing ')'");
+            return -1;
+        }
+        ++token;
+        return child;
+    }
+
+    return parseCondition(error);
+}
+
+int LogFilter::parseCondition(QString &error)
+{
+    static const struct
+    {
+        const char *name;
+        Field      field;
+        Type       type;
+    } fields[]=
+    {
+        { "src",    FIELD_SRC,    NODE_ADDRESS },
+        { "dst",    FIELD_DST,    NODE_ADDRESS },
+        { "spt",    FIELD_SPT,    NODE_PORT },
+        { "dpt",    FIELD_DPT,    NODE_PORT },
+        { "proto",  FIELD_PROTO,  NODE_TEXT },
+        { "in",     FIELD_IN,     NODE_TEXT },
+        { "out",    FIELD_OUT,    NODE_TEXT },
+        { "iface",  FIELD_IFACE,  NODE_TEXT },
+        { "action", FIELD_ACTION, NODE_TEXT },
+        { 0L,       FIELD_SRC,    NODE_TEXT }
+    };
+
+    QString name=tokens[token++].toLower();
+    int     f=0;
+
+    while(fields[f].name && name!=QLatin1String(fields[f].name))
+        ++f;
+    if(!fields[f].name)
+    {
+        error=i18n("Unknown field '%1'", name);
+        return -1;
+    }
+
+    Field field=fields[f].field;
+    Type  type=fields[f].type;
+    bool  negate=false;
+
+    if(token<tokens.count())
+    {
+        if("="==tokens[token] || "=="==tokens[token] || 0==tokens[token].compare("in", Qt::CaseInsensitive))
+            ++token;
+        else if("!="==tokens[token])
+        {
+            negate=true;
+            ++token;
+        }
+    }
+
+    if(token>=tokens.count() || ")"==tokens[token])
+    {
+        error=i18n("Missing value for '%1'", name);
+        return -1;
+    }
+
+    // Allow spaces after the commas of a list
+    QString value=tokens[token++];
+
+    while(value.endsWith(',') && token<tokens.count())
+        value+=tokens[token++];
+
+    QStringList values=value.split(',', QString::SkipEmptyParts);
+
+    // e.g. "dpt ," - which would otherwise never match
+    if(values.isEmpty())
+    {
+        error=i18n("Missing value for '%1'", name);
+        return -1;
+    }
+
+    QStringList::ConstIterator it(values.constBegin()),
+                               end(values.constEnd());
+    int                        node=addNode(type, -1, -1);
+    Node                       &n=nodes[node];
+
+    n.field=field;
+    for(; it!=end; ++it)
+        switch(type)
+        {
+            case NODE_ADDRESS:
+            {
+                Address    addr;
+                QByteArray str=(*it).section('/', 0, 0).toLatin1();
+                QString    bits=(*it).section('/', 1);
+                bool       ok=toAddress(str.constData(), str.length(), addr.v6, addr.bytes);
+
+                addr.bits=addr.v6 ? 128 : 32;
+                if(ok && !bits.isEmpty())
+                {
+                    int b=bits.toInt(&ok);
+
+                    ok=ok && b>=0 && b<=addr.bits;
+                    addr.bits=b;
+                }
+                if(!ok)
+                {
+                    error=i18n("Invalid address '%1'", *it);
+                    return -1;
+                }
+                n.addresses.append(addr);
+                break;
+            }
+            case NODE_PORT:
+            {
+                QStringList parts=(*it).split(QRegExp("[-:]"));
+                bool        ok=parts.count()<=2;
+                uint        from=ok ? parts[0].toUInt(&ok) : 0,
+                            to=from;
+
+                if(ok && 2==parts.count())
+                    to=parts[1].toUInt(&ok);
+                if(!ok || from>to || to>MAX_PORT)
+                {
+                    error=i18n("Invalid port '%1'", *it);
+                    return -1;
+                }
+                n.ports.append(Range(from, to));
+                break;
+            }
+            default:
+                n.texts.append((*it).toUtf8());
+        }
+
+    // Merge the port ranges, so that they can be binary searched
+    if(NODE_PORT==type)
+    {
+        QVector<Range> merged;
+
+        std::sort(n.ports.begin(), n.ports.end(), rangeLessThan);
+        for(int i=0; i<n.ports.count(); ++i)
+            if(!merged.isEmpty() && n.ports[i].first<=merged.last().second+1)
+                merged.last().second=qMax(merged.last().second, n.ports[i].second);
+            else
+                merged.append(n.ports[i]);
+        n.ports=merged;
+    }
+
+    return negate ? addNode(NODE_NOT, node, -1) : node;
+}
+
+int LogFilter::addNode(Type type, int left, int right)
+{
+    Node node;
+
+    node.type=type;
+    node.field=FIELD_SRC;
+    node.left=left;
+    node.right=right;
+    nodes.append(node);
+    return nodes.count()-1;
+}
+
+bool LogFilter::eval(int node, const LogEntry &entry) const
+{
+    const Node &n=nodes[node];
+
+    switch(n.type)
+    {
+        case NODE_AND:
+            return eval(n.left, entry) && eval(n.right, entry);
+        case NODE_OR:
+            return eval(n.left, entry) || eval(n.right, entry);
+        case NODE_NOT:
+            return !eval(n.left, entry);
+        case NODE_ADDRESS:
+        {
+            const LogField                  &field=FIELD_SRC==n.field ? entry.src : entry.dst;
+            QVector<Address>::ConstIterator it(n.addresses.constBegin()),
+                                            end(n.addresses.constEnd());
+            bool                            v6;
+            quint8                          bytes[16];
+
+            if(!toAddress(field.data, field.length, v6, bytes))
+                return false;
+
+            for(; it!=end; ++it)
+            {
+                int full=(*it).bits/8,
+                    rest=(*it).bits%8;
+
+                if((*it).v6==v6 && 0==memcmp(bytes, (*it).bytes, full) &&
+                   (0==rest || 0==((bytes[full]^(*it).bytes[full])&(0xFF<<(8-rest))&0xFF)))
+                    return true;
+            }
+            return false;
+        }
+        case NODE_PORT:
+        {
+            bool ok=false;
+            uint port=(FIELD_SPT==n.field ? entry.spt : entry.dpt).toUInt(&ok);
+            int  low=0,
+                 high=n.ports.count();
+
+            if(!ok)
+                return false;
+            while(low<high)
+            {
+                int mid=(low+high)/2;
+
+                if(n.ports[mid].second<port)
+                    low=mid+1;
+                else
+                    high=mid;
+            }
+            return low<n.ports.count() && n.ports[low].first<=port;
+        }
+        case NODE_TEXT:
+            switch(n.field)
+            {
+                case FIELD_PROTO:
+                    return textMatches(n.texts, entry.proto);
+                case FIELD_IN:
+                    return textMatches(n.texts, entry.in);
+                case FIELD_OUT:
+                    return textMatches(n.texts, entry.out);
+                case FIELD_IFACE:
+                    return textMatches(n.texts, entry.in) || textMatches(n.texts, entry.out);
+                case FIELD_ACTION:
+                    return textMatches(n.texts, entry.action);
+                default:
+                    return false;
+            }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,119 @@
+#ifndef UFW_LOG_FILTER_H
+#define UFW_LOG_FILTER_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logentry.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+namespace UFW
+{
+
+//
+// Log entry filter, compiled from an expression such as
+//
+//   src in 10.0.0.0/8 and dpt 22 and action=BLOCK
+//
+// Each condition is a field (src, dst, spt, dpt, proto, in, out, iface, action), an optional operator ('=', '==',
+// '!=', or 'in') and a comma separated list of values. Addresses may be CIDR networks, and ports may be ranges (e.g.
+// 6000-6010). Conditions are combined with 'and', 'or', 'not', and parentheses. Values are converted when the filter
+// is compiled, so matching an entry only compares numbers - addresses are not compared as strings.
+class LogFilter
+{
+    public:
+
+    LogFilter() : root(-1) { }
+
+    bool isEmpty() const                     { return root<0; }
+    bool compile(const QString &expr, QString &error);
+    bool matches(const LogEntry &entry) const { return root<0 || eval(root, entry); }
+
+    private:
+
+    enum Type
+    {
+        NODE_AND,
+        NODE_OR,
+        NODE_NOT,
+        NODE_ADDRESS,
+        NODE_PORT,
+        NODE_TEXT
+    };
+
+    enum Field
+    {
+        FIELD_SRC,
+        FIELD_DST,
+        FIELD_SPT,
+        FIELD_DPT,
+        FIELD_PROTO,
+        FIELD_IN,
+        FIELD_OUT,
+        FIELD_IFACE,
+        FIELD_ACTION
+    };
+
+    struct Address
+    {
+        bool   v6;
+        int    bits;
+        quint8 bytes[16];
+    };
+
+    typedef QPair<uint, uint> Range;
+
+    struct Node
+    {
+        Type              type;
+        Field             field;
+        int               left,
+                          right;
+        QVector<Address>  addresses;
+        QVector<Range>    ports;     // Sorted, and not overlapping
+        QList<QByteArray> texts;
+    };
+
+    int  parseOr(QString &error);
+    int  parseAnd(QString &error);
+    int  parseNot(QString &error);
+    int  parseCondition(QString &error);
+    int  addNode(Type type, int left, int right);
+    bool eval(int node, const LogEntry &entry) const;
+
+    private:
+
+    QVector<Node> nodes;
+    int           root;
+    QStringList   tokens;   // Only used whilst compiling
+    int           token;
+};
+
+}
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logmodel.h"
+#include "types.h"
+#include "rule.h"
+#include <KDE/KGlobal>
+#include <KDE/KLocale>
+#include <QtCore/QDateTime>
+#include <QtCore/QtAlgorithms>
+
+namespace UFW
+{
+
+#define MIN_CAPACITY 1024 // Entries - the columns grow by doubling from this, up to maxEntries()
+
+LogModel::LogModel(QObject *parent)
+        : QAbstractTableModel(parent)
+        , first(0)
+        , count(0)
+        , maxCount(1)
+        , nextChunk(0)
+        , parsedRow(-1)
+        , firstSeq(0)
+        , matchedStart(0)
+        , parser(new LogParser(this))
+        , epoch(0)
+        , filterId(0)
+{
+    connect(parser, SIGNAL(parsed()), SLOT(addParsed()));
+}
+
+LogModel::~LogModel()
+{
+}
+
+void LogModel::setMaxEntries(int m)
+{
+    maxCount=qMax(1, m);
+    if(count>maxCount)
+        remove(count-maxCount);
+    if(capacity()>maxCount)
+        reserve(0);
+}
+
+// Add the lines of a buffer from the helper after those already held. If there are more than maxEntries(), then only
+// the newest are kept. The lines are added once the parser thread has split the buffer.
+void LogModel::append(const QByteArray &log)
+{
+    queue(log, false);
+}
+
+// Add the lines of an older log before those already held. Entries are not removed to make room for these, instead
+// only the newest lines that fit are added - prepended() is emitted once they have been.
+void LogModel::prepend(const QByteArray &log)
+{
+    queue(log, true);
+}
+
+void LogModel::clear()
+{
+    beginResetModel();
+    chunks.clear();
+    offsets.clear();
+    lengths.clear();
+    times.clear();
+    actions.clear();
+    buffers.clear();
+    summ.clear();
+    matched.clear();
+    first=count=matchedStart=0;
+    firstSeq=0;
+    parsedRow=-1;
+    ++epoch;
+    endResetModel();
+}
+
+// Only show the entries matching a filter expression - an empty expression shows all entries. If the expression is
+// invalid, then the filter is not changed.
+bool LogModel::setFilter(const QString &expr, QString &error)
+{
+    LogFilter f;
+
+    if(!f.compile(expr, error))
+        return false;
+
+    beginResetModel();
+    filter=f;
+    ++filterId;
+    matched.clear();
+    matchedStart=0;
+    if(!filter.isEmpty())
+        for(int i=0; i<count; ++i)
+            if(parse(i) && filter.matches(parsed))
+                matched.append(firstSeq+i);
+    endResetModel();
+    return true;
+}
+
+// Parse a row's line. The fields are only valid until the model is next changed.
+bool LogModel::entry(int row, LogEntry &e) const
+{
+    if(row<0 || row>=rowCount() || !parse(entryOf(row)))
+        return false;
+    e=parsed;
+    return true;
+}
+
+int LogModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : filter.isEmpty() ? count : matched.count()-matchedStart;
+}
+
+int LogModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : COL_COUNT;
+}
+
+QVariant LogModel::data(const QModelIndex &index, int role) const
+{
+    if(Qt::DisplayRole!=role || !index.isValid() || index.row()>=rowCount())
+        return QVariant();
+
+    int e=entryOf(index.row()),
+        s=slot(e);
+
+    if(COL_ACTION==index.column())
+        switch(actions[s])
+        {
+            case LogParser::ACT_BLOCK:
+                return Types::toString(Types::POLICY_DENY); // i18n("Block");
+            case LogParser::ACT_ALLOW:
+                return Types::toString(Types::POLICY_ALLOW); // i18n("Allow");
+            default:
+                break;
+        }
+
+    if(!parse(e))
+        return QVariant();
+
+    switch(index.column())
+    {
+        case COL_RAW:
+            return parsed.line.toString();
+        case COL_DATE:
+            return times[s]
+                    ? KGlobal::locale()->formatDateTime(QDateTime::fromTime_t(times[s]), KLocale::ShortDate, true)
+                    : parsed.timestamp.toString();
+        case COL_ACTION:
+            return parsed.action.toString();
+        case COL_FROM:
+            return Rule::modify(parsed.src.toString(), parsed.spt.toString(), QString(), parsed.in.toString(),
+                                Types::toProtocol(parsed.proto.toString().toLower()), true);
+        case COL_TO:
+            return Rule::modify(parsed.dst.toString(), parsed.dpt.toString(), QString(), parsed.out.toString(),
+                                Types::toProtocol(parsed.proto.toString().toLower()), true);
+        default:
+            return QVariant();
+    }
+}
+
+QVariant LogModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(Qt::Horizontal!=orientation || Qt::DisplayRole!=role)
+        return QVariant();
+
+    switch(section)
+    {
+        case COL_RAW:
+            return i18n("Raw");
+        case COL_DATE:
+            return i18n("Date");
+        case COL_ACTION:
+            return i18n("Action");
+        case COL_FROM:
+            return i18n("From");
+        case COL_TO:
+            return i18n("To");
+        default:
+            return QVariant();
+    }
+}
+
+// Re-allocate the columns, so that they can hold at least 'needed' entries - and move the entries to the start. If
+// 'needed' is 0, the columns are shrunk to fit maxEntries().
+void LogModel::reserve(int needed)
+{
+    if(needed && needed<=capacity())
+        return;
+
+    int              size=needed ? qMin(maxCount, qMax(needed, qMax(capacity()*2, MIN_CAPACITY))) : maxCount;
+    QVector<quint32> newChunks(size),
+                     newOffsets(size),
+                     newLengths(size),
+                     newTimes(size);
+    QVector<quint8>  newActions(size);
+
+    for(int i=0; i<count; ++i)
+    {
+        int s=slot(i);
+
+        newChunks[i]=chunks[s];
+        newOffsets[i]=offsets[s];
+        newLengths[i]=lengths[s];
+        newTimes[i]=times[s];
+        newActions[i]=actions[s];
+    }
+    chunks=newChunks;
+    offsets=newOffsets;
+    lengths=newLengths;
+    times=newTimes;
+    actions=newActions;
+    first=0;
+}
+
+// Remove the oldest entries, and any buffers no longer referred to
+void LogModel::remove(int rows)
+{
+    // Number of the entries that are shown
+    int shown=filter.isEmpty()
+                ? rows
+                : qLowerBound(matched.begin()+matchedStart, matched.end(), firstSeq+rows)-(matched.begin()+matchedStart);
+
+    parsedRow=-1;
+    if(shown)
+        beginRemoveRows(QModelIndex(), 0, shown-1);
+    for(int i=0; i<rows; ++i)
+    {
+        if(parse(i))
+            summ.remove(parsed, times[slot(i)]);
+
+        QHash<quint32, Chunk>::Iterator it=buffers.find(chunks[slot(i)]);
+
+        if(it!=buffers.end() && 0==--(*it).refs)
+            buffers.erase(it);
+    }
+    parsedRow=-1;
+    first=(first+rows)%capacity();
+    firstSeq+=rows;
+    count-=rows;
+    if(!filter.isEmpty())
+    {
+        matchedStart+=shown;
+        if(matchedStart>matched.count()/2)
+        {
+            matched.remove(0, matchedStart);
+            matchedStart=0;
+        }
+    }
+    if(shown)
+        endRemoveRows();
+}
+
+void LogModel::store(int slot, quint32 chunk, const Line &line)
+{
+    chunks[slot]=chunk;
+    offsets[slot]=line.offset;
+    lengths[slot]=line.length;
+    times[slot]=line.time;
+    actions[slot]=line.action;
+}
+
+void LogModel::queue(const QByteArray &log, bool atStart)
+{
+    LogParser::Batch *batch=new LogParser::Batch;
+
+    batch->log=log;
+    batch->epoch=epoch;
+    batch->filterId=filterId;
+    batch->filter=filter;
+    batch->atStart=atStart;
+    batch->limit=atStart ? maxCount-count : maxCount;
+    parser->queue(batch);
+}
+
+// Add the batches the parser thread has finished with - those queued before the model was last cleared are discarded
+void LogModel::addParsed()
+{
+    while(LogParser::Batch *batch=parser->take())
+    {
+        if(batch->epoch==epoch)
+            add(*batch);
+        delete batch;
+    }
+}
+
+// Store the lines of a split batch. Entries may have been added since the batch was queued, so fewer of an older log's
+// lines may now fit - these are skipped, and removed from the batch's summary.
+void LogModel::add(LogParser::Batch &batch)
+{
+    QVector<Line> &lines=batch.lines;
+    const char    *data=batch.log.constData();
+    int           skip=qMax(0, lines.count()-(batch.atStart ? maxCount-count : maxCount)),
+                  n=lines.count()-skip;
+
+    for(int i=0; i<skip; ++i)
+    {
+        LogEntry entry;
+
+        if(entry.parse(data+lines[i].offset, lines[i].length))
+            batch.summary.remove(entry, lines[i].time);
+    }
+
+    // The filter was changed whilst the batch was being split
+    if(batch.filterId!=filterId)
+        for(int i=skip; i<lines.count(); ++i)
+        {
+            LogEntry entry;
+
+            lines[i].shown=entry.parse(data+lines[i].offset, lines[i].length) && filter.matches(entry);
+        }
+
+    if(n>0)
+    {
+        if(!batch.atStart && count+n>maxCount)
+            remove(count+n-maxCount);
+        reserve(count+n);
+
+        int     row=batch.atStart ? 0 : count;
+        quint32 chunk=nextChunk++;
+        Chunk   &c=buffers[chunk];
+
+        c.data=batch.log;
+        c.refs=n;
+        summ.merge(batch.summary);
+        parsedRow=-1;
+        if(filter.isEmpty())
+            beginInsertRows(QModelIndex(), row, row+n-1);
+        if(batch.atStart)
+        {
+            first=(first+capacity()-n)%capacity();
+            firstSeq-=n;
+        }
+        for(int i=0; i<n; ++i)
+            store(slot(row+i), chunk, lines[skip+i]);
+        count+=n;
+        if(filter.isEmpty())
+            endInsertRows();
+        else
+            show(lines, skip, n, batch.atStart);
+    }
+
+    if(batch.atStart)
+        emit prepended(batch.dropped+skip);
+}
+
+// Add the entries, just stored, that match the filter to the rows shown. The 'n' entries are either the first, or last,
+// entries held - and were lines[skip] onwards.
+void LogModel::show(const QVector<Line> &lines, int skip, int n, bool atStart)
+{
+    QVector<qint64> seqs;
+    qint64          seq=atStart ? firstSeq : firstSeq+count-n;
+
+    for(int i=0; i<n; ++i)
+        if(lines[skip+i].shown)
+            seqs.append(seq+i);
+
+    if(seqs.isEmpty())
+        return;
+
+    int rows=rowCount();
+
+    if(atStart)
+    {
+        beginInsertRows(QModelIndex(), 0, seqs.count()-1);
+        matched=seqs+matched.mid(matchedStart);
+        matchedStart=0;
+    }
+    else
+    {
+        beginInsertRows(QModelIndex(), rows, rows+seqs.count()-1);
+        matched+=seqs;
+    }
+    endInsertRows();
+}
+
+bool LogModel::parse(int row) const
+{
+    if(row!=parsedRow)
+    {
+        int                                  s=slot(row);
+        QHash<quint32, Chunk>::ConstIterator it=buffers.constFind(chunks[s]);
+
+        parsedRow=-1;
+        if(it==buffers.constEnd() || !parsed.parse((*it).data.constData()+offsets[s], lengths[s]))
+            return false;
+        parsedRow=row;
+    }
+    return true;
+}
+
+}
+
+#include "logmodel.moc"
@@ -0,0 +1,139 @@
+#ifndef UFW_LOG_MODEL_H
+#define UFW_LOG_MODEL_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logentry.h"
+#include "logsummary.h"
+#include "logfilter.h"
+#include "logparser.h"
+#include <QtCore/QAbstractTableModel>
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+namespace UFW
+{
+
+//
+// Log entries, held as columns of a ring buffer. Each entry only stores where its line is within the buffer received
+// from the helper - the line is parsed again, and its strings created, when the view asks for them. Once maxEntries()
+// is reached, the oldest entries are removed as new ones are added. A summary of the entries held is kept up to date
+// as they are added and removed. If a filter is set, then only the matching entries are shown - each entry is only
+// checked against the filter as it is added. Buffers are split into lines by a LogParser thread, so are only added
+// once this has finished with them.
+class LogModel : public QAbstractTableModel
+{
+    Q_OBJECT
+
+    public:
+
+    enum Columns
+    {
+        COL_RAW,
+        COL_DATE,
+        COL_ACTION,
+        COL_FROM,
+        COL_TO,
+
+        COL_COUNT
+    };
+
+    LogModel(QObject *parent);
+    virtual ~LogModel();
+
+    int                maxEntries() const { return maxCount; }
+    int                entries() const    { return count; } // Including those hidden by the filter
+    void               setMaxEntries(int m);
+    void               append(const QByteArray &log);
+    void               prepend(const QByteArray &log);
+    void               clear();
+    bool               setFilter(const QString &expr, QString &error);
+    bool               entry(int row, LogEntry &e) const;
+    const LogSummary & summary() const    { return summ; }
+
+    int                rowCount(const QModelIndex &parent=QModelIndex()) const;
+    int                columnCount(const QModelIndex &parent=QModelIndex()) const;
+    QVariant           data(const QModelIndex &index, int role=Qt::DisplayRole) const;
+    QVariant           headerData(int section, Qt::Orientation orientation, int role=Qt::DisplayRole) const;
+
+    Q_SIGNALS:
+
+    // Emitted once the lines of prepend() have been added - 'dropped' is the number that did not fit
+    void               prepended(int dropped);
+
+    private Q_SLOTS:
+
+    void               addParsed();
+
+    private:
+
+    typedef LogParser::Line Line;
+
+    // Buffer from the helper, and the number of entries referring to it
+    struct Chunk
+    {
+        QByteArray data;
+        int        refs;
+    };
+
+    // Internally, rows are the entries held - which are only the rows of the model when there is no filter
+    int  slot(int row) const   { return (first+row)%capacity(); }
+    int  capacity() const      { return offsets.size(); }
+    int  entryOf(int row) const { return filter.isEmpty() ? row : (int)(matched[matchedStart+row]-firstSeq); }
+    void reserve(int needed);
+    void remove(int rows);
+    void store(int slot, quint32 chunk, const Line &line);
+    void queue(const QByteArray &log, bool atStart);
+    void add(LogParser::Batch &batch);
+    void show(const QVector<Line> &lines, int skip, int n, bool atStart);
+    bool parse(int row) const;
+
+    private:
+
+    QVector<quint32>        chunks,    // Columns - indexed by slot
+                            offsets,
+                            lengths,
+                            times;     // Seconds since the epoch - only formatted when displayed
+    QVector<quint8>         actions;
+    int                     first,     // Slot of row 0
+                            count,
+                            maxCount;
+    QHash<quint32, Chunk>   buffers;
+    quint32                 nextChunk;
+    mutable int             parsedRow; // Last row parsed by data() - as the view asks for each column of a row in turn
+    mutable LogEntry        parsed;
+    LogSummary              summ;
+    LogFilter               filter;
+    qint64                  firstSeq;     // Sequence number of row 0 - each entry keeps its number until removed
+    QVector<qint64>         matched;      // Sequence numbers of the entries that match the filter
+    int                     matchedStart; // Removed entries are only erased from 'matched' once half of it is unused
+    LogParser               *parser;
+    quint32                 epoch,        // Incremented when cleared - batches queued before this are discarded
+                            filterId;     // Incremented when the filter is set
+};
+
+}
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logparser.h"
+#include <QtCore/QMutexLocker>
+#include <QtCore/QtConcurrentMap>
+#include <time.h>
+
+namespace UFW
+{
+
+#define PARALLEL_SPLIT_SIZE (1024*1024) // Bytes - larger buffers from the helper are split into parts, in parallel
+#define PARALLEL_PARTS      4 // Parts per thread - so that threads finishing early can take another
+
+LogParser::LogParser(QObject *parent)
+         : QThread(parent)
+         , stopped(false)
+         , space(QUEUE_SIZE)
+{
+    start(QThread::LowPriority);
+}
+
+LogParser::~LogParser()
+{
+    mutex.lock();
+    stopped=true;
+    wake.wakeOne();
+    mutex.unlock();
+    // In case the thread is waiting for space to return a batch
+    space.release();
+    wait();
+
+    qDeleteAll(jobs);
+    while(Batch *batch=results.pop())
+        delete batch;
+}
+
+// Takes ownership of the batch - it is returned, by take(), once split
+void LogParser::queue(Batch *batch)
+{
+    QMutexLocker locker(&mutex);
+
+    jobs.enqueue(batch);
+    wake.wakeOne();
+}
+
+// GUI thread only - returns 0L once there are no more split batches
+LogParser::Batch * LogParser::take()
+{
+    Batch *batch=results.pop();
+
+    if(batch)
+        space.release();
+    return batch;
+}
+
+void LogParser::run()
+{
+    forever
+    {
+        Batch *batch=0L;
+
+        mutex.lock();
+        while(!stopped && jobs.isEmpty())
+            wake.wait(&mutex);
+        if(!stopped)
+            batch=jobs.dequeue();
+        mutex.unlock();
+
+        if(!batch)
+            return;
+
+        split(*batch);
+        space.acquire();
+
+        QMutexLocker locker(&mutex);
+
+        if(stopped)
+        {
+            delete batch;
+            return;
+        }
+        results.push(batch);
+        emit parsed();
+    }
+}
+
+// Find the UFW lines within a batch's buffer. Large buffers (i.e. history) are split into parts at line ends, and these
+// are parsed in parallel - each with its own summary. The parts' lines, and summaries, are then combined in order. If
+// there are more lines than the batch's limit, then the first are dropped - and the buffer is copied, so that these are
+// not kept in memory.
+void LogParser::split(Batch &batch)
+{
+    const char    *data=batch.log.constData(),
+                  *pos=data,
+                  *end=pos+batch.log.size();
+    int           numParts=batch.log.size()<PARALLEL_SPLIT_SIZE
+                            ? 1 : qMax(1, QThread::idealThreadCount())*PARALLEL_PARTS,
+                  numLines=0;
+    qint64        now=::time(0L);
+    QVector<Part> parts;
+
+    for(int i=1; i<=numParts && pos<end; ++i)
+    {
+        const char *split=i<numParts ? qMax(pos, data+(qint64)batch.log.size()*i/numParts) : end,
+                   *eol=split<end ? (const char *)memchr(split, '\n', end-split) : 0L;
+        Part       part;
+
+        part.filter=&batch.filter;
+        part.data=data;
+        part.start=pos;
+        part.end=eol ? eol+1 : end;
+        part.now=now;
+        parts.append(part);
+        pos=part.end;
+    }
+
+    if(1==parts.count())
+        splitPart(parts[0]);
+    else
+        QtConcurrent::blockingMap(parts, splitPart);
+
+    QVector<Part>::Iterator it(parts.begin()),
+                            pEnd(parts.end());
+
+    for(; it!=pEnd; ++it)
+        numLines+=(*it).lines.count();
+
+    int skip=batch.dropped=qMax(0, numLines-qMax(0, batch.limit));
+
+    batch.lines.reserve(numLines-skip);
+    for(it=parts.begin(); it!=pEnd; ++it)
+    {
+        int n=(*it).lines.count();
+
+        // Parts whose lines are all dropped are not added to the summary at all
+        if(skip>=n)
+        {
+            skip-=n;
+            continue;
+        }
+
+        for(int i=0; i<skip; ++i)
+        {
+            LogEntry entry;
+
+            if(entry.parse(data+(*it).lines[i].offset, (*it).lines[i].length))
+                (*it).summary.remove(entry, (*it).lines[i].time);
+        }
+        batch.summary.merge((*it).summary);
+        batch.lines+=skip ? (*it).lines.mid(skip) : (*it).lines;
+        skip=0;
+    }
+
+    if(batch.dropped)
+    {
+        quint32 base=batch.lines.isEmpty() ? 0 : batch.lines.first().offset;
+
+        batch.log=batch.lines.isEmpty() ? QByteArray() : batch.log.mid(base);
+        for(int i=0; i<batch.lines.count(); ++i)
+            batch.lines[i].offset-=base;
+    }
+}
+
+// Parse the lines of a part of a buffer. This is called from other threads, so only uses the part itself.
+void LogParser::splitPart(Part &part)
+{
+    const char *pos=part.start;
+
+    while(pos<part.end)
+    {
+        const char *eol=(const char *)memchr(pos, '\n', part.end-pos);
+        LogEntry   entry;
+
+        if(!eol)
+            eol=part.end;
+
+        if(entry.parse(pos, eol-pos))
+        {
+            Line line;
+
+            line.offset=pos-part.data;
+            line.length=entry.line.length;
+            line.time=(quint32)qMax((qint64)0, part.logTime.toTime(entry.timestamp, part.now));
+            line.action=entry.action=="BLOCK" ? ACT_BLOCK : entry.action=="ALLOW" ? ACT_ALLOW : ACT_OTHER;
+            line.shown=part.filter->matches(entry);
+            part.lines.append(line);
+            part.summary.add(entry, line.time);
+        }
+        pos=eol+1;
+    }
+}
+
+}
+
+#include "logparser.moc"
@@ -0,0 +1,132 @@
+#ifndef UFW_LOG_PARSER_H
+#define UFW_LOG_PARSER_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logsummary.h"
+#include "logfilter.h"
+#include "logtime.h"
+#include "spscqueue.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QQueue>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QWaitCondition>
+
+namespace UFW
+{
+
+//
+// Thread that finds, and parses, the UFW lines of the buffers received from the helper - so that the dialog remains
+// responsive whilst a large log is read. Buffers are queued as batches, and returned (in the same order) once split
+// into lines. Finished batches are passed back through a lock-free queue, and parsed() is emitted - the batches are
+// then taken from this by the GUI thread.
+class LogParser : public QThread
+{
+    Q_OBJECT
+
+    public:
+
+    enum Constants
+    {
+        QUEUE_SIZE = 16 // Batches that may be waiting to be taken - once full, the thread waits
+    };
+
+    enum Action
+    {
+        ACT_BLOCK,
+        ACT_ALLOW,
+        ACT_OTHER
+    };
+
+    // Position, time, and action, of a line within a buffer from the helper - and whether it matches the filter
+    struct Line
+    {
+        quint32 offset,
+                length,
+                time;    // Seconds since the epoch, or 0 if unknown
+        quint8  action;
+        bool    shown;
+    };
+
+    struct Batch
+    {
+        QByteArray    log;       // If lines are dropped, this is cut to start at the first line kept
+        quint32       epoch;     // Set, and checked, by the model
+        quint32       filterId;
+        LogFilter     filter;
+        bool          atStart;   // Lines are to be placed before those already held
+        int           limit,     // Only the last 'limit' lines are kept...
+                      dropped;   // ...and the number not kept is set here
+        QVector<Line> lines;
+        LogSummary    summary;   // Of the lines kept
+    };
+
+    LogParser(QObject *parent);
+    virtual ~LogParser();
+
+    void    queue(Batch *batch);
+    Batch * take();
+
+    Q_SIGNALS:
+
+    void parsed();
+
+    protected:
+
+    void run();
+
+    private:
+
+    // Part of a buffer, from the start of a line to the end of another - large buffers are split in parallel
+    struct Part
+    {
+        const LogFilter *filter;
+        const char      *data,   // Start of the buffer - the lines' offsets are from this
+                        *start,
+                        *end;
+        qint64          now;
+        LogTime         logTime;
+        QVector<Line>   lines;
+        LogSummary      summary;
+    };
+
+    static void split(Batch &batch);
+    static void splitPart(Part &part);
+
+    private:
+
+    QMutex                        mutex;   // Protects 'jobs', and 'stopped'
+    QWaitCondition                wake;
+    QQueue<Batch *>               jobs;
+    bool                          stopped;
+    SpscQueue<Batch, QUEUE_SIZE>  results;
+    QSemaphore                    space;   // Free entries of 'results'
+};
+
+}
+
+#endif
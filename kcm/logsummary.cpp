@@ -0,0 +1,145 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logsummary.h"
+#include <QtCore/QVector>
+#include <algorithm>
+
+namespace UFW
+{
+
+#define MAX_PORT_KEY 32 // Bytes of a "port/protocol" key
+
+typedef QPair<quint32, const QByteArray *> Ranked;
+
+static bool moreThan(const Ranked &a, const Ranked &b)
+{
+    return a.first>b.first || (a.first==b.first && *a.second<*b.second);
+}
+
+void LogSummary::clear()
+{
+    for(int i=0; i<KEY_COUNT; ++i)
+        counts[i].clear();
+    timeBuckets.clear();
+    entries=0;
+}
+
+// Add the counts of another summary - i.e. of another part of the same log
+void LogSummary::merge(const LogSummary &other)
+{
+    for(int i=0; i<KEY_COUNT; ++i)
+    {
+        QHash<QByteArray, quint32>::ConstIterator it(other.counts[i].constBegin()),
+                                                  end(other.counts[i].constEnd());
+
+        for(; it!=end; ++it)
+            counts[i][it.key()]+=it.value();
+    }
+
+    QMap<qint64, quint32>::ConstIterator it(other.timeBuckets.constBegin()),
+                                         end(other.timeBuckets.constEnd());
+
+    for(; it!=end; ++it)
+        timeBuckets[it.key()]+=it.value();
+    entries+=other.entries;
+}
+
+// The 'count' items with the highest counts - only these are sorted, so this is quick even with many items
+QList<LogSummary::Item> LogSummary::top(Key key, int count) const
+{
+    const QHash<QByteArray, quint32>          &hash=counts[key];
+    QHash<QByteArray, quint32>::ConstIterator it(hash.constBegin()),
+                                              end(hash.constEnd());
+    QVector<Ranked>                           ranked;
+    QList<Item>                               items;
+
+    ranked.reserve(hash.count());
+    for(; it!=end; ++it)
+        ranked.append(Ranked(it.value(), &it.key()));
+
+    count=qMin(count, ranked.count());
+    std::partial_sort(ranked.begin(), ranked.begin()+count, ranked.end(), moreThan);
+    for(int i=0; i<count; ++i)
+        items.append(Item(*ranked[i].second, ranked[i].first));
+    return items;
+}
+
+void LogSummary::update(const LogEntry &entry, qint64 time, int delta)
+{
+    count(KEY_SRC, entry.src.data, entry.src.length, delta);
+    count(KEY_DST, entry.dst.data, entry.dst.length, delta);
+    count(KEY_ACTION, entry.action.data, entry.action.length, delta);
+    if(entry.in.isEmpty())
+        count(KEY_INTERFACE, entry.out.data, entry.out.length, delta);
+    else
+        count(KEY_INTERFACE, entry.in.data, entry.in.length, delta);
+
+    if(!entry.dpt.isEmpty() && entry.dpt.length+entry.proto.length<MAX_PORT_KEY)
+    {
+        char port[MAX_PORT_KEY];
+        int  length=entry.dpt.length;
+
+        memcpy(port, entry.dpt.data, length);
+        port[length++]='/';
+        for(int i=0; i<entry.proto.length; ++i)
+            port[length++]=entry.proto.data[i]>='A' && entry.proto.data[i]<='Z'
+                            ? entry.proto.data[i]-'A'+'a' : entry.proto.data[i];
+        count(KEY_PORT, port, length, delta);
+    }
+
+    if(time)
+    {
+        qint64                          hour=time-(time%BUCKET_SECS);
+        QMap<qint64, quint32>::Iterator it=timeBuckets.find(hour);
+
+        if(it==timeBuckets.end())
+        {
+            if(delta>0)
+                timeBuckets.insert(hour, delta);
+        }
+        else if(0==((*it)+=delta))
+            timeBuckets.erase(it);
+    }
+    entries+=delta;
+}
+
+// The key is only copied when it is first seen
+void LogSummary::count(Key key, const char *data, int length, int delta)
+{
+    if(!length)
+        return;
+
+    QHash<QByteArray, quint32>           &hash=counts[key];
+    QHash<QByteArray, quint32>::Iterator it=hash.find(QByteArray::fromRawData(data, length));
+
+    if(it==hash.end())
+    {
+        if(delta>0)
+            hash.insert(QByteArray(data, length), delta);
+    }
+    else if(0==((*it)+=delta))
+        hash.erase(it);
+}
+
+}
@@ -0,0 +1,87 @@
+#ifndef UFW_LOG_SUMMARY_H
+#define UFW_LOG_SUMMARY_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "logentry.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+#include <QtCore/QPair>
+
+namespace UFW
+{
+
+//
+// Counts of log entries per source, destination, port, interface, action, and hour. These are updated as each entry
+// is added or removed, so are never recomputed from the entries themselves.
+class LogSummary
+{
+    public:
+
+    enum Key
+    {
+        KEY_SRC,
+        KEY_DST,
+        KEY_PORT,      // Destination port and protocol - e.g. "22/tcp"
+        KEY_INTERFACE, // Incoming interface, or outgoing if none
+        KEY_ACTION,
+
+        KEY_COUNT
+    };
+
+    enum Constants
+    {
+        BUCKET_SECS = 60*60
+    };
+
+    typedef QPair<QByteArray, quint32> Item;
+
+    LogSummary() : entries(0) { }
+
+    // 'time' is that of the entry's timestamp, in seconds since the epoch - or 0 if unknown
+    void                         add(const LogEntry &entry, qint64 time)    { update(entry, time, 1); }
+    void                         remove(const LogEntry &entry, qint64 time) { update(entry, time, -1); }
+    void                         clear();
+    void                         merge(const LogSummary &other);
+    quint32                      total() const                 { return entries; }
+    QList<Item>                  top(Key key, int count) const;
+    const QMap<qint64, quint32> & buckets() const              { return timeBuckets; }
+
+    private:
+
+    void update(const LogEntry &entry, qint64 time, int delta);
+    void count(Key key, const char *data, int length, int delta);
+
+    private:
+
+    QHash<QByteArray, quint32> counts[KEY_COUNT];
+    QMap<qint64, quint32>      timeBuckets; // Start of each hour, and its number of entries
+    quint32                    entries;
+};
+
+}
+
+#endif
@@ -22,110 +22,89 @@
  */
 
 #include "logviewer.h"
+#include "logmodel.h"
 #include "types.h"
 #include "rule.h"
 #include "kcm.h"
 #include <kdeversion.h>
 #include <KDE/KAction>
+#include <KDE/KActionMenu>
+#include <KDE/KComboBox>
+#include <KDE/KLineEdit>
+#include <KDE/KMenu>
+#include <KDE/KMessageBox>
 #include <KDE/KToolBar>
 #include <KDE/KConfig>
 #include <KDE/KConfigGroup>
 #include <KDE/KGlobal>
 #include <KDE/KLocale>
 #include <QtGui/QVBoxLayout>
+#include <QtGui/QSplitter>
+#include <QtGui/QTreeView>
 #include <QtGui/QTreeWidget>
 #include <QtGui/QHeaderView>
+#include <QtCore/QDateTime>
 #include <QtCore/QTimer>
 
 namespace UFW
 {
 
-enum Columns
-{
-    COL_RAW,
-    COL_DATE,
-    COL_ACTION,
-    COL_FROM,
-    COL_TO
-};
-
-#define CFG_GROUP      "KCM_UFW_LogViewer"
-#define CFG_LIST_STATE "ListState"
-#define CFG_SHOW_RAW   "Raw"
-#define CFG_SIZE       "Size"
+#define CFG_GROUP       "KCM_UFW_LogViewer"
+#define CFG_LIST_STATE  "ListState"
+#define CFG_SHOW_RAW    "Raw"
+#define CFG_SIZE        "Size"
+#define CFG_MAX_ENTRIES "MaxEntries"
+#define CFG_SUMMARY     "Summary"
 
-static int strToMonth(const QString &str)
-{
-    static QMap<QString, int> map;
-    
-    if(map.isEmpty())
-    {
-        map["Jan"]=1;
-        map["Feb"]=2;
-        map["Mar"]=3;
-        map["Apr"]=4;
-        map["May"]=5;
-        map["Jun"]=6;
-        map["Jul"]=7;
-        map["Aug"]=8;
-        map["Sep"]=9;
-        map["Oct"]=10;
-        map["Nov"]=11;
-        map["Dec"]=12;
-    }
+#define DEFAULT_MAX_ENTRIES 500000 // Once reached, the oldest entries are removed as new ones arrive
+#define RETRY_DELAY         1000   // ms - if the helper is busy, or following fails, wait this long before retrying
 
-    return map.contains(str) ? map[str] : -1;
-}
+#define SUMMARY_TOP_COUNT   20  // Items listed for each summary key
+#define SUMMARY_INTERVAL    500 // ms - whilst entries arrive, the summary is re-listed at most this often
+#define FILTER_DELAY        300 // ms - the filter is applied once typing pauses for this long
 
-static QString parseDate(const QString &monthStr, const QString &dayStr, const QString &timeStr)
+static bool isBusy(const ActionReply &reply)
 {
-    int month=strToMonth(monthStr),
-        day=-1,
-        h=-1,
-        m=-1,
-        s=-1;
-    
-    if(-1!=month)
-    {
-        day=dayStr.toInt();
-        h=timeStr.mid(0, 2).toInt();
-        m=timeStr.mid(3, 2).toInt();
-        s=timeStr.mid(6, 2).toInt();
-
-        if(s>-1)
-        {
-            QDateTime dateTime(QDate(QDate::currentDate().year(), month, day), QTime(h, m, s));
-            if (dateTime.isValid())
-                return KGlobal::locale()->formatDateTime(dateTime, KLocale::ShortDate, true);
-        }
-    }
-
-    return monthStr+QChar(' ')+dayStr+QChar(' ')+timeStr;
+    return ActionReply::KAuthError==reply.type() && ActionReply::HelperBusy==reply.errorCode();
 }
 
 LogViewer::LogViewer(Kcm *p)
          : KDialog(p)
          , kcm(p)
+         , logInode(0)
+         , logOffset(0)
          , headerSizesSet(false)
+         , viewActive(false)
+         , replaceEntries(false)
+         , followActive(false)
+         , followPaused(false)
+         , haveHistory(true)
+         , historyMore(false)
 {
     setupWidgets();
     setupActions();
-    refresh();
-    // Can't restore QHeaderView in constructor, so use a timer - and restore after eventloop starts.
-    QTimer::singleShot(0, this, SLOT(restoreState()));
 
     KConfigGroup grp(KGlobal::config(), CFG_GROUP);
     QSize        sz=grp.readEntry(CFG_SIZE, QSize(800, 400));
 
+    model->setMaxEntries(grp.readEntry(CFG_MAX_ENTRIES, DEFAULT_MAX_ENTRIES));
+    refresh();
+    // Can't restore QHeaderView in constructor, so use a timer - and restore after eventloop starts.
+    QTimer::singleShot(0, this, SLOT(restoreState()));
+
     if(sz.isValid())
         resize(sz);
 }
 
 LogViewer::~LogViewer()
 {
+    if(followActive)
+        followAction.stop();
+
     KConfigGroup grp(KGlobal::config(), CFG_GROUP);
     grp.writeEntry(CFG_LIST_STATE, list->header()->saveState());
     grp.writeEntry(CFG_SHOW_RAW, toggleRawAction->isChecked());
+    grp.writeEntry(CFG_SUMMARY, toggleSummaryAction->isChecked());
     grp.writeEntry(CFG_SIZE, size());
 }
 
@@ -141,46 +120,344 @@ void LogViewer::restoreState()
     
     toggleRawAction->setChecked(grp.readEntry(CFG_SHOW_RAW, false));
     toggleDisplay();
+    toggleSummaryAction->setChecked(grp.readEntry(CFG_SUMMARY, false));
 }
 
 void LogViewer::refresh()
 {
     QVariantMap args;
-    args["lastLine"]=lastLine;
+    // Only lines written since the last refresh are returned - and only as many as can be listed
+    args["inode"]=logInode;
+    args["offset"]=logOffset;
+    args["maxLines"]=model->maxEntries();
+    view(args);
+}
+
+// The helper can only run one action at a time - so whilst the KCM, or the follow action, is using it the request is
+// held (replacing any already held) until it is free. Following is not started until the reply has been received.
+void LogViewer::view(const QVariantMap &args)
+{
+    if(followPaused || followActive || viewActive)
+    {
+        pendingView=args;
+        return;
+    }
+
+    pendingView.clear();
     viewAction.setArguments(args);
+    viewActive=true;
+    replaceEntries=args.contains("since");
+    historyLog.clear();
+    enableActions();
     viewAction.execute();
 }
 
+void LogViewer::sendPendingView()
+{
+    if(!pendingView.isEmpty())
+        view(pendingView);
+}
+
+// Don't keep the helper busy following the log once the dialog has been closed
+void LogViewer::hideEvent(QHideEvent *event)
+{
+    toggleFollowAction->setChecked(false);
+    KDialog::hideEvent(event);
+}
+
+// The helper can only run one action at a time - so the KCM pauses the log viewer whilst it has requests to send.
+// Returns true if a follow, or view, action is still running - in which case helperReleased() is emitted once it has
+// finished.
+bool LogViewer::pauseFollow()
+{
+    followPaused=true;
+    enableActions();
+    if(followActive)
+        followAction.stop();
+    return followActive || viewActive;
+}
+
+void LogViewer::resumeFollow()
+{
+    if(followPaused)
+    {
+        followPaused=false;
+        sendPendingView();
+        startFollow();
+        enableActions();
+    }
+}
+
+// Refreshing, and reading older entries, are disabled whilst following the log - and whilst the helper is in use
+void LogViewer::enableActions()
+{
+    bool idle=!toggleFollowAction->isChecked() && !followActive && !viewActive && !followPaused;
+
+    refreshAction->setEnabled(idle);
+    recentAction->setEnabled(idle);
+    loadOlderAction->setEnabled(idle && haveHistory && !historyLine.isEmpty());
+}
+
+void LogViewer::setFollow(bool on)
+{
+    enableActions();
+    if(on)
+        startFollow();
+    else if(followActive)
+        followAction.stop();
+}
+
+void LogViewer::startFollow()
+{
+    if(followActive || followPaused || viewActive || !pendingView.isEmpty() || !toggleFollowAction->isChecked())
+        return;
+
+    QVariantMap args;
+    args["follow"]=true;
+    args["inode"]=logInode;
+    args["offset"]=logOffset;
+    followAction.setArguments(args);
+    followActive=true;
+    followAction.execute();
+}
+
+// Both actions share a watcher. Whilst following, new lines are pushed by the helper as they are written - otherwise,
+// large replies are sent in chunks, which only contain lines.
+void LogViewer::progress(const QVariantMap &data)
+{
+    if(viewActive && viewAction.arguments().contains("olderThan"))
+        historyLog+=data["log"].toByteArray();
+    else if(viewActive)
+    {
+        clearReplaced();
+        model->append(data["log"].toByteArray());
+    }
+    else
+        addLines(data);
+}
+
+void LogViewer::followPerformed(const ActionReply &reply)
+{
+    followActive=false;
+    if(reply.succeeded())
+        addLines(reply.data());
+    else if(!isBusy(reply))
+    {
+        // Retrying would most likely fail again, so stop following
+        toggleFollowAction->setChecked(false);
+        KMessageBox::error(this, i18n("<p>Failed to follow the log.</p><p><i>%1</i></p>", reply.errorDescription()));
+    }
+    enableActions();
+    emit helperReleased();
+
+    // Any held request is sent first - and if the helper was busy, then following is tried again later
+    if(!followPaused && !pendingView.isEmpty())
+        sendPendingView();
+    else if(!followPaused && toggleFollowAction->isChecked())
+        QTimer::singleShot(reply.succeeded() ? 0 : RETRY_DELAY, this, SLOT(startFollow()));
+}
+
 void LogViewer::toggleDisplay()
 {
-    list->setColumnHidden(COL_DATE, toggleRawAction->isChecked());
-    list->setColumnHidden(COL_ACTION, toggleRawAction->isChecked());
-    list->setColumnHidden(COL_FROM, toggleRawAction->isChecked());
-    list->setColumnHidden(COL_TO, toggleRawAction->isChecked());
-    list->setColumnHidden(COL_RAW, !toggleRawAction->isChecked());
+    list->setColumnHidden(LogModel::COL_DATE, toggleRawAction->isChecked());
+    list->setColumnHidden(LogModel::COL_ACTION, toggleRawAction->isChecked());
+    list->setColumnHidden(LogModel::COL_FROM, toggleRawAction->isChecked());
+    list->setColumnHidden(LogModel::COL_TO, toggleRawAction->isChecked());
+    list->setColumnHidden(LogModel::COL_RAW, !toggleRawAction->isChecked());
 }
 
+// Both actions share a watcher - but only one is run at a time, so the reply is for whichever is active
 void LogViewer::queryPerformed(ActionReply reply)
 {
-    QStringList lines=reply.succeeded() ? reply.data()["lines"].toStringList() : QStringList();
+    if(viewActive)
+        viewPerformed(reply);
+    else if(followActive)
+        followPerformed(reply);
+}
 
-    if(!lines.isEmpty())
+void LogViewer::viewPerformed(const ActionReply &reply)
+{
+    viewActive=false;
+    if(reply.succeeded())
+    {
+        if(reply.data()["history"].toBool())
+            addHistory(reply.data());
+        else if(reply.data()["window"].toBool())
+            addWindow(reply.data());
+        else
+            addLines(reply.data());
+    }
+    else if(isBusy(reply))
     {
-        QStringList::ConstIterator it(lines.constBegin()),
-                                   end(lines.constEnd());
-                    
+        // e.g. the KCM sent a request before this dialog was opened - so try again later, unless replaced
+        if(pendingView.isEmpty())
+            pendingView=viewAction.arguments();
+        QTimer::singleShot(RETRY_DELAY, this, SLOT(sendPendingView()));
+    }
+    else
+        KMessageBox::error(this, i18n("<p>Failed to read the log.</p><p><i>%1</i></p>", reply.errorDescription()));
+    enableActions();
+    emit helperReleased();
+    if(!isBusy(reply))
+        sendPendingView();
+    startFollow();
+}
+
+// Older entries are read one rotated log at a time, and placed before those already listed - only as many as there is
+// room for are read.
+void LogViewer::loadOlder()
+{
+    int room=model->maxEntries()-model->entries();
+
+    if(room<=0)
+        return;
+
+    QVariantMap args;
+    args["olderThan"]=historyLine;
+    args["maxLines"]=room;
+    view(args);
+}
+
+// Only show the entries from a given time - the helper uses its index of the log's times to find where to start
+// reading, so this is quick even for a large log.
+void LogViewer::showRecent(QAction *action)
+{
+    QVariantMap args;
+    args["since"]=(qint64)QDateTime::currentDateTime().toTime_t()-action->data().toInt();
+    args["maxLines"]=model->maxEntries();
+    view(args);
+}
+
+void LogViewer::addLines(const QVariantMap &data)
+{
+    logInode=data["inode"].toULongLong();
+    logOffset=data["offset"].toLongLong();
+    if(historyLine.isEmpty() && data.contains("firstLine"))
+    {
+        historyLine=data["firstLine"].toByteArray();
+        enableActions();
+    }
+    model->append(data["log"].toByteArray());
+}
+
+// The lines are parsed by another thread - so loading older entries is disabled until they have been added. Large
+// replies are sent in chunks - these are collected, so that the lines are placed before those listed in one go.
+void LogViewer::addHistory(const QVariantMap &data)
+{
+    historyLine=data["firstLine"].toByteArray();
+    historyMore=data["more"].toBool();
+    haveHistory=false;
+    historyLog+=data["log"].toByteArray();
+    model->prepend(historyLog);
+    historyLog.clear();
+    enableActions();
+}
+
+// Once the maximum number of entries is reached, no older entries can be added
+void LogViewer::historyAdded(int dropped)
+{
+    haveHistory=0==dropped && historyMore && !historyLine.isEmpty() && model->entries()<model->maxEntries();
+    enableActions();
+}
+
+// The entries of a time window replace those listed - once the first of these has been received. There may be a gap
+// between these and the older logs, so loading older entries is disabled.
+void LogViewer::clearReplaced()
+{
+    if(replaceEntries)
+    {
+        model->clear();
+        replaceEntries=false;
+    }
+}
+
+void LogViewer::addWindow(const QVariantMap &data)
+{
+    clearReplaced();
+    haveHistory=false;
+    addLines(data);
+    enableActions();
+}
+
+void LogViewer::setShowSummary(bool on)
+{
+    summaryPane->setVisible(on);
+    updateSummary();
+}
+
+// The model keeps the summary up to date as entries arrive, so only the listing of it needs to be updated
+void LogViewer::scheduleSummary()
+{
+    if(!summaryPane->isHidden() && !summaryTimer->isActive())
+        summaryTimer->start();
+}
+
+void LogViewer::updateSummary()
+{
+    if(summaryPane->isHidden())
+        return;
+
+    const LogSummary         &summary=model->summary();
+    int                      key=summaryKey->currentIndex();
+    QList<QTreeWidgetItem *> items;
+
+    if(key>=0 && key<LogSummary::KEY_COUNT)
+    {
+        QList<LogSummary::Item>                top=summary.top((LogSummary::Key)key, SUMMARY_TOP_COUNT);
+        QList<LogSummary::Item>::ConstIterator it(top.constBegin()),
+                                               end(top.constEnd());
+
+        for(; it!=end; ++it)
+            items.append(new QTreeWidgetItem(QStringList() << QString::fromUtf8((*it).first)
+                                                           << QString::number((*it).second)));
+    }
+    else
+    {
+        // Entries per hour, newest first
+        const QMap<qint64, quint32>          &buckets=summary.buckets();
+        QMap<qint64, quint32>::ConstIterator it(buckets.constBegin()),
+                                             end(buckets.constEnd());
+
         for(; it!=end; ++it)
         {
-            parse(*it);
-            lastLine=*it;
-        }
-        
-        if(!headerSizesSet && list->topLevelItemCount()>0)
-        {
-            list->header()->resizeSections(QHeaderView::ResizeToContents);
-            headerSizesSet=true;
+            QString hour=KGlobal::locale()->formatDateTime(QDateTime::fromTime_t(it.key()), KLocale::ShortDate);
+
+            items.prepend(new QTreeWidgetItem(QStringList() << hour << QString::number(it.value())));
         }
     }
+
+    summaryList->clear();
+    summaryList->setHeaderLabels(QStringList() << summaryKey->currentText() << i18n("Entries"));
+    summaryList->addTopLevelItems(items);
+}
+
+void LogViewer::applyFilter()
+{
+    QString  error;
+    QPalette pal(filterEdit->palette());
+
+    // Whilst the expression is invalid, the previous filter remains in use
+    if(model->setFilter(filterEdit->text(), error))
+    {
+        pal.setColor(QPalette::Text, palette().color(QPalette::Text));
+        filterEdit->setToolTip(QString());
+    }
+    else
+    {
+        pal.setColor(QPalette::Text, Qt::red);
+        filterEdit->setToolTip(error);
+    }
+    filterEdit->setPalette(pal);
+    selectionChanged();
+}
+
+void LogViewer::resizeHeader()
+{
+    if(!headerSizesSet && model->rowCount()>0)
+    {
+        list->header()->resizeSections(QHeaderView::ResizeToContents);
+        headerSizesSet=true;
+    }
 }
 
 void LogViewer::setupWidgets()
@@ -188,34 +465,94 @@ void LogViewer::setupWidgets()
     QWidget     *mainWidget=new QWidget(this);
     QVBoxLayout *layout=new QVBoxLayout(mainWidget);
     KToolBar    *toolbar=new KToolBar(mainWidget);
-    KAction     *refreshAction=new KAction(KIcon("view-refresh"), i18n("Refresh"), this);
+    refreshAction=new KAction(KIcon("view-refresh"), i18n("Refresh"), this);
     toggleRawAction=new KAction(KIcon("flag-red"), i18n("Display Raw"), this);
     toggleRawAction->setCheckable(true);
+    toggleFollowAction=new KAction(KIcon("media-playback-start"), i18n("Follow"), this);
+    toggleFollowAction->setCheckable(true);
+    loadOlderAction=new KAction(KIcon("go-up"), i18n("Load Older"), this);
+    loadOlderAction->setEnabled(false);
     createRuleAction=new KAction(KIcon("list-add"), i18n("Create Rule"), this);
+    toggleSummaryAction=new KAction(KIcon("view-statistics"), i18n("Summary"), this);
+    toggleSummaryAction->setCheckable(true);
+    recentAction=new KActionMenu(KIcon("chronometer"), i18n("Show Recent"), this);
+    recentAction->setDelayed(false);
+    recentAction->menu()->addAction(i18n("Last 15 Minutes"))->setData(15*60);
+    recentAction->menu()->addAction(i18n("Last Hour"))->setData(60*60);
+    recentAction->menu()->addAction(i18n("Last Day"))->setData(24*60*60);
+    recentAction->menu()->addAction(i18n("Last Week"))->setData(7*24*60*60);
+    connect(recentAction->menu(), SIGNAL(triggered(QAction *)), SLOT(showRecent(QAction *)));
     connect(toggleRawAction, SIGNAL(toggled(bool)), SLOT(toggleDisplay()));
     connect(refreshAction, SIGNAL(triggered(bool)), SLOT(refresh()));
+    connect(toggleFollowAction, SIGNAL(toggled(bool)), SLOT(setFollow(bool)));
+    connect(loadOlderAction, SIGNAL(triggered(bool)), SLOT(loadOlder()));
     connect(createRuleAction, SIGNAL(triggered(bool)), SLOT(createRule()));
+    connect(toggleSummaryAction, SIGNAL(toggled(bool)), SLOT(setShowSummary(bool)));
     toolbar->addAction(refreshAction);
     toolbar->addAction(toggleRawAction);
+    toolbar->addAction(toggleFollowAction);
+    toolbar->addAction(loadOlderAction);
+    toolbar->addAction(recentAction);
     toolbar->addAction(createRuleAction);
+    toolbar->addAction(toggleSummaryAction);
     toolbar->setSizePolicy(QSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Fixed));
-    list=new QTreeWidget(this);
-    QTreeWidgetItem *headerItem = list->headerItem();
-    headerItem->setText(COL_RAW, i18n("Raw"));
-    headerItem->setText(COL_DATE, i18n("Date"));
-    headerItem->setText(COL_ACTION, i18n("Action"));
-    headerItem->setText(COL_FROM, i18n("From"));
-    headerItem->setText(COL_TO, i18n("To"));
+    filterEdit=new KLineEdit(mainWidget);
+    filterEdit->setClearButtonShown(true);
+    filterEdit->setClickMessage(i18n("Filter - e.g. src in 10.0.0.0/8 and dpt 22 and action=BLOCK"));
+    filterEdit->setToolTip(QString());
+    filterTimer=new QTimer(this);
+    filterTimer->setSingleShot(true);
+    filterTimer->setInterval(FILTER_DELAY);
+    connect(filterEdit, SIGNAL(textChanged(QString)), filterTimer, SLOT(start()));
+    connect(filterTimer, SIGNAL(timeout()), SLOT(applyFilter()));
+    QSplitter   *splitter=new QSplitter(mainWidget);
+    model=new LogModel(this);
+    list=new QTreeView(splitter);
+    list->setModel(model);
     list->setRootIsDecorated(false);
     list->setItemsExpandable(false);
     list->setAllColumnsShowFocus(true);
+    // All rows are one line high - so the view does not need to ask for the size of each entry
+    list->setUniformRowHeights(true);
+
+    summaryPane=new QWidget(splitter);
+    QVBoxLayout *summaryLayout=new QVBoxLayout(summaryPane);
+    summaryKey=new KComboBox(summaryPane);
+    summaryKey->addItem(i18n("Source"));        // LogSummary::KEY_SRC
+    summaryKey->addItem(i18n("Destination"));   // LogSummary::KEY_DST
+    summaryKey->addItem(i18n("Port"));          // LogSummary::KEY_PORT
+    summaryKey->addItem(i18n("Interface"));     // LogSummary::KEY_INTERFACE
+    summaryKey->addItem(i18n("Action"));        // LogSummary::KEY_ACTION
+    summaryKey->addItem(i18n("Hour"));
+    summaryList=new QTreeWidget(summaryPane);
+    summaryList->setRootIsDecorated(false);
+    summaryList->setItemsExpandable(false);
+    summaryList->setAllColumnsShowFocus(true);
+    summaryLayout->setMargin(0);
+    summaryLayout->addWidget(summaryKey);
+    summaryLayout->addWidget(summaryList);
+    summaryPane->setVisible(false);
+    summaryTimer=new QTimer(this);
+    summaryTimer->setSingleShot(true);
+    summaryTimer->setInterval(SUMMARY_INTERVAL);
+    splitter->setStretchFactor(0, 3);
+    splitter->setStretchFactor(1, 1);
+    connect(summaryKey, SIGNAL(currentIndexChanged(int)), SLOT(updateSummary()));
+    connect(summaryTimer, SIGNAL(timeout()), SLOT(updateSummary()));
+    connect(model, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(scheduleSummary()));
+    connect(model, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(scheduleSummary()));
+    connect(model, SIGNAL(modelReset()), SLOT(scheduleSummary()));
+    connect(model, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(resizeHeader()));
+    connect(model, SIGNAL(prepended(int)), SLOT(historyAdded(int)));
+
     layout->addWidget(toolbar);
-    layout->addWidget(list);
+    layout->addWidget(filterEdit);
+    layout->addWidget(splitter);
     setMainWidget(mainWidget);
     setCaption(i18n("Log Viewer"));
     setButtons(KDialog::Close);
     
-    connect(list, SIGNAL(itemSelectionChanged()), SLOT(selectionChanged()));
+    connect(list->selectionModel(), SIGNAL(selectionChanged(QItemSelection, QItemSelection)), SLOT(selectionChanged()));
     selectionChanged();
 }
 
@@ -226,124 +563,38 @@ void LogViewer::setupActions()
 #if KDE_IS_VERSION(4, 5, 90)
     viewAction.setParentWidget(this);
 #endif
-//     queryAction.setExecutesAsync(true);
+    viewAction.setExecutesAsync(true);
     connect(viewAction.watcher(), SIGNAL(actionPerformed(ActionReply)), SLOT(queryPerformed(ActionReply)));
-}
-
-void LogViewer::parse(const QString &line)
-{
-    // Apr  6 11:42:41 kubuntu-10 kernel: [36122.101381] [UFW BLOCK] IN= OUT=eth0 SRC=1.2.3.4 DST=1.2.3.4 LEN=76 TOS=0x00 PREC=0x00 TTL=64 ID=0 DF PROTO=UDP SPT=1 DPT=1 LEN=56
-    QString l(line);
-    l=l.replace("[UFW ", "[UFW_");
-    l=l.replace("\n", "");
-    QStringList parts=l.split(' ', QString::SkipEmptyParts);
-    
-    if(parts.length()>11)
-    {
-        QStringList::ConstIterator it(parts.constBegin()),
-                                   end(parts.constEnd());
-        QString                    destAddress,
-                                   sourceAddress,
-                                   destPort,
-                                   sourcePort,
-                                   interfaceIn,
-                                   interfaceOut,
-                                   action,
-                                   date=parseDate(parts[0], parts[1], parts[2]);
-        Types::Protocol            protocol=Types::PROTO_BOTH;
-        
-        for(; it!=end; ++it)
-        {           
-            if((*it).startsWith(QLatin1String("IN=")))
-                interfaceIn=(*it).mid(3);
-            else if((*it).startsWith(QLatin1String("OUT=")))
-                interfaceOut=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("SRC=")))
-                sourceAddress=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("DST=")))
-                destAddress=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("PROTO=")))
-                protocol=Types::toProtocol((*it).mid(6).toLower());
-            else if((*it).startsWith(QLatin1String("SPT=")))
-                sourcePort=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("DPT=")))
-                destPort=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("[UFW_")))
-            {
-                if(QLatin1String("[UFW_BLOCK]")==(*it))
-                    action=Types::toString(Types::POLICY_DENY); // i18n("Block");
-                else if(QLatin1String("[UFW_ALLOW]")==(*it))
-                    action=Types::toString(Types::POLICY_ALLOW); // i18n("Allow");
-                else
-                {
-                    action=(*it).mid(5);
-                    action.replace("]", "");
-                }
-            }
-        }
 
-        l=l.replace("[UFW_", "[UFW "); // Revert!
-        new QTreeWidgetItem(list, QStringList() << l
-                                                << date
-                                                << action
-                                                << Rule::modify(sourceAddress, sourcePort, QString(), interfaceIn, protocol, true)
-                                                << Rule::modify(destAddress, destPort, QString(), interfaceOut, protocol, true));
-    }
+    followAction=KAuth::Action("org.kde.ufw.viewlog");
+    followAction.setHelperID("org.kde.ufw");
+#if KDE_IS_VERSION(4, 5, 90)
+    followAction.setParentWidget(this);
+#endif
+    followAction.setExecutesAsync(true);
+    // Both actions have the same name, and so share a watcher - whose actionPerformed() is already connected above
+    connect(followAction.watcher(), SIGNAL(progressStep(QVariantMap)), SLOT(progress(QVariantMap)));
 }
 
 void LogViewer::selectionChanged()
 {
-    createRuleAction->setEnabled(1==list->selectedItems().count());
+    createRuleAction->setEnabled(1==list->selectionModel()->selectedRows().count());
 }
 
 void LogViewer::createRule()
 {
-    QList<QTreeWidgetItem *> items=list->selectedItems();
-    QTreeWidgetItem          *item=items.count() ? items.first() : 0L;
+    QModelIndexList rows=list->selectionModel()->selectedRows();
+    LogEntry        entry;
 
-    if(item)
+    if(1==rows.count() && model->entry(rows.first().row(), entry))
     {
-        QString l(item->text(COL_RAW));
-        l=l.replace("[UFW ", "[UFW_");
-        QStringList                parts=l.split(' ', QString::SkipEmptyParts);
-        QStringList::ConstIterator it(parts.constBegin()),
-                                   end(parts.constEnd());
-        QString                    destAddress,
-                                   sourceAddress,
-                                   destPort,
-                                   sourcePort,
-                                   interfaceIn,
-                                   interfaceOut,
-                                   action;
-        Types::Protocol            protocol=Types::PROTO_BOTH;
-        Types::Policy              pol=Types::POLICY_DENY;
-        
-        for(; it!=end; ++it)
-        {           
-            if((*it).startsWith(QLatin1String("IN=")))
-                interfaceIn=(*it).mid(3);
-            else if((*it).startsWith(QLatin1String("OUT=")))
-                interfaceOut=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("SRC=")))
-                sourceAddress=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("DST=")))
-                destAddress=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("PROTO=")))
-                protocol=Types::toProtocol((*it).mid(6).toLower());
-            else if((*it).startsWith(QLatin1String("SPT=")))
-                sourcePort=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("DPT=")))
-                destPort=(*it).mid(4);
-            else if((*it).startsWith(QLatin1String("[UFW_")))
-            {
-                // Invert rule type - as we are creating the inverse of what the log says!
-                pol=QLatin1String("[UFW_BLOCK]")==(*it) ? Types::POLICY_ALLOW : Types::POLICY_DENY;
-            }
-        }
+        // Invert rule type - as we are creating the inverse of what the log says!
+        Types::Policy  pol=entry.action=="BLOCK" ? Types::POLICY_ALLOW : Types::POLICY_DENY;
 
-        kcm->createRule(Rule(pol, interfaceOut.isEmpty(), Types::LOGGING_OFF, protocol, QString(), QString(), 
-                            sourceAddress, sourcePort,  destAddress, destPort,
-                            interfaceIn, interfaceOut));
+        kcm->createRule(Rule(pol, entry.out.isEmpty(), Types::LOGGING_OFF,
+                             Types::toProtocol(entry.proto.toString().toLower()), QString(), QString(),
+                             entry.src.toString(), entry.spt.toString(), entry.dst.toString(), entry.dpt.toString(),
+                             entry.in.toString(), entry.out.toString()));
     }
 }
 
@@ -26,10 +26,17 @@
 
 #include <kauth.h>
 #include <KDE/KDialog>
+#include <QtCore/QByteArray>
 #include <QtCore/QString>
 
+class QTreeView;
 class QTreeWidget;
+class QTimer;
+class QAction;
+class KComboBox;
+class KLineEdit;
 class KAction;
+class KActionMenu;
 
 using namespace KAuth;
 
@@ -37,6 +44,7 @@ namespace UFW
 {
 
 class Kcm;
+class LogModel;
 
 class LogViewer : public KDialog
 {
@@ -47,30 +55,83 @@ class LogViewer : public KDialog
     LogViewer(Kcm *p);
     virtual ~LogViewer();
 
+    bool pauseFollow();
+    void resumeFollow();
+
+    Q_SIGNALS:
+
+    void helperReleased();
+
+    protected:
+
+    void hideEvent(QHideEvent *event);
+
     public Q_SLOTS:
     
     void restoreState();
     void refresh();
     void toggleDisplay();
     void queryPerformed(ActionReply reply);
+    void setFollow(bool on);
+    void startFollow();
+    void sendPendingView();
+    void progress(const QVariantMap &data);
+    void loadOlder();
+    void showRecent(QAction *action);
+    void setShowSummary(bool on);
+    void scheduleSummary();
+    void updateSummary();
+    void applyFilter();
     void createRule();
     void selectionChanged();
+    void resizeHeader();
+    void historyAdded(int dropped);
 
     private:
 
     void setupWidgets();
     void setupActions();
-    void parse(const QString &line);
+    void view(const QVariantMap &args);
+    void viewPerformed(const ActionReply &reply);
+    void followPerformed(const ActionReply &reply);
+    void addLines(const QVariantMap &data);
+    void addHistory(const QVariantMap &data);
+    void clearReplaced();
+    void addWindow(const QVariantMap &data);
+    void enableActions();
 
     private:
     
     Kcm         *kcm;
-    Action      viewAction;
-    QString     lastLine;
-    QTreeWidget *list;
-    KAction     *toggleRawAction,
-                *createRuleAction;
-    bool        headerSizesSet;
+    Action      viewAction,
+                followAction;
+    quint64     logInode;
+    qint64      logOffset;
+    QByteArray  historyLine,
+                historyLog;    // Chunks of older entries, received before the reply
+    QVariantMap pendingView;   // Request held until the helper is free
+    LogModel    *model;
+    QTreeView   *list;
+    KAction     *refreshAction,
+                *toggleRawAction,
+                *toggleFollowAction,
+                *loadOlderAction,
+                *createRuleAction,
+                *toggleSummaryAction;
+    KActionMenu *recentAction;
+    QWidget     *summaryPane;
+    KComboBox   *summaryKey;
+    QTreeWidget *summaryList;
+    QTimer      *summaryTimer,
+                *filterTimer;
+    KLineEdit   *filterEdit;
+    bool        headerSizesSet,
+                viewActive,
+                replaceEntries,
+                followActive,
+                followPaused,
+                haveHistory,
+                historyMore;
 };
 
 }
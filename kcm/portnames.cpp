@@ -0,0 +1,178 @@
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "portnames.h"
+#include "appprofiles.h"
+#include "rule.h"
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QByteArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+
+namespace UFW
+{
+
+#define MAX_PORT      65535
+#define MAX_RANGE     1024 // Ports - larger ranges (e.g. "1024:65535") are not named, as they are not for one service
+#define SERVICES_FILE "/etc/services"
+
+static QBasicAtomicPointer<PortNames> instance=Q_BASIC_ATOMIC_INITIALIZER(0L);
+
+// The tables are built by the first call, which must be on the GUI thread - Kcm's constructor does so. As with
+// Q_GLOBAL_STATIC, the pointer is set with testAndSetOrdered(), so the tables are complete before it is seen.
+const PortNames & PortNames::get()
+{
+    if(!instance)
+    {
+        Q_ASSERT(QThread::currentThread()==QCoreApplication::instance()->thread());
+
+        PortNames *names=new PortNames;
+
+        if(!instance.testAndSetOrdered(0L, names))
+            delete names;
+    }
+    return *instance;
+}
+
+QString PortNames::name(const QString &port, Types::Protocol prot, bool anyProtocol) const
+{
+    bool ok;
+    uint num=port.toUInt(&ok);
+
+    if(!ok || num>MAX_PORT)
+    {
+        QString n=lists.value(port+Rule::protocolSuffix(prot));
+
+        return n.isEmpty() && anyProtocol ? lists.value(port) : n;
+    }
+
+    QHash<quint16, QString>::ConstIterator it=named[prot].constFind(num);
+
+    if(it!=named[prot].constEnd())
+        return *it;
+    if(anyProtocol && Types::PROTO_BOTH!=prot &&
+       (it=named[Types::PROTO_BOTH].constFind(num))!=named[Types::PROTO_BOTH].constEnd())
+        return *it;
+    if((it=services[prot].constFind(num))!=services[prot].constEnd())
+        return *it;
+    return services[Types::PROTO_BOTH].value(num);
+}
+
+PortNames::PortNames()
+{
+    // Single ports are added first, so that these take precedence over ports within the lists and ranges of others
+    for(int pass=0; pass<2; ++pass)
+        for(int i=0; i<Types::PP_COUNT; ++i)
+        {
+            Types::PredefinedPort      pp=(Types::PredefinedPort)i;
+            QStringList                entries=Types::toString(pp).split(' ', QString::SkipEmptyParts);
+            QStringList::ConstIterator it(entries.constBegin()),
+                                       end(entries.constEnd());
+
+            for(; it!=end; ++it)
+                if((0==pass)==(!(*it).contains(',') && !(*it).contains(':')))
+                    add(*it, Types::toString(pp, true));
+        }
+
+    QList<AppProfiles::Entry>::ConstIterator it(AppProfiles::get().constBegin()),
+                                             end(AppProfiles::get().constEnd());
+
+    for(; it!=end; ++it)
+    {
+        QStringList                entries=(*it).ports.split(' ', QString::SkipEmptyParts);
+        QStringList::ConstIterator eIt(entries.constBegin()),
+                                   eEnd(entries.constEnd());
+
+        for(; eIt!=eEnd; ++eIt)
+            add(*eIt, (*it).name);
+    }
+
+    readServices();
+}
+
+// Name each port of an entry such as "135,139,445/tcp" or "6881:6891", unless it already has a name
+void PortNames::add(const QString &ports, const QString &name)
+{
+    if(!lists.contains(ports))
+        lists.insert(ports, name);
+
+    Types::Protocol            prot=ports.contains('/') ? Types::toProtocol(ports.section('/', 1)) : Types::PROTO_BOTH;
+    QStringList                items=ports.section('/', 0, 0).split(',', QString::SkipEmptyParts);
+    QStringList::ConstIterator it(items.constBegin()),
+                               end(items.constEnd());
+
+    for(; it!=end; ++it)
+    {
+        bool fromOk,
+             toOk=true;
+        uint from=(*it).section(':', 0, 0).toUInt(&fromOk),
+             to=(*it).contains(':') ? (*it).section(':', 1).toUInt(&toOk) : from;
+
+        if(!fromOk || !toOk || from>to || to>MAX_PORT || to-from>=MAX_RANGE)
+            continue;
+
+        for(uint p=from; p<=to; ++p)
+            if(!named[prot].contains(p))
+                named[prot].insert(p, name);
+    }
+}
+
+// Read "name port/protocol [aliases] [# comment]" lines. As with getservbyport(), the first name listed for a port is
+// used - and the first for any protocol is used for PROTO_BOTH.
+void PortNames::readServices()
+{
+    QFile file(SERVICES_FILE);
+
+    if(!file.open(QIODevice::ReadOnly))
+        return;
+
+    while(!file.atEnd())
+    {
+        QByteArray line=file.readLine();
+        int        comment=line.indexOf('#');
+
+        if(comment>=0)
+            line.truncate(comment);
+
+        QList<QByteArray> parts=line.simplified().split(' ');
+        int               slash=parts.count()>1 ? parts[1].indexOf('/') : -1;
+        bool              ok=false;
+        uint              port=slash>0 ? parts[1].left(slash).toUInt(&ok) : 0;
+
+        if(!ok || port>MAX_PORT)
+            continue;
+
+        Types::Protocol prot=Types::toProtocol(QString::fromLatin1(parts[1].mid(slash+1)));
+        QString         name=QString::fromLatin1(parts[0]);
+
+        if(Types::PROTO_BOTH!=prot && !services[prot].contains(port))
+            services[prot].insert(port, name);
+        if(!services[Types::PROTO_BOTH].contains(port))
+            services[Types::PROTO_BOTH].insert(port, name);
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef UFW_PORT_NAMES_H
+#define UFW_PORT_NAMES_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "types.h"
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+namespace UFW
+{
+
+//
+// Names of ports, per protocol - from the predefined ports, the application profiles, and /etc/services (in that order
+// of preference). These are read once into tables that are not changed afterwards. As reading them uses i18n(), and
+// the application profiles, get() must first be called on the GUI thread (Kcm's constructor does so) - after that,
+// names may be looked up from any thread.
+class PortNames
+{
+    public:
+
+    static const PortNames & get();
+
+    // Name of a port, or of a list of ports (e.g. "135,139,445"), or an empty string if it has none. Ports listed
+    // without a protocol only match PROTO_BOTH - unless 'anyProtocol' is set, in which case they match either.
+    QString name(const QString &port, Types::Protocol prot, bool anyProtocol=false) const;
+
+    private:
+
+    PortNames();
+
+    void add(const QString &ports, const QString &name);
+    void readServices();
+
+    private:
+
+    QHash<QString, QString> lists;                      // Whole entries - e.g. "135,139,445/tcp"
+    QHash<quint16, QString> named[Types::PROTO_COUNT],  // Predefined ports, and profiles
+                            services[Types::PROTO_COUNT];
+};
+
+}
+
+#endif
@@ -28,7 +28,9 @@
 #include <QtCore/QFile>
 #include <QtCore/QStringList>
 #include <QtCore/QTextStream>
+#include <QtCore/QDataStream>
 #include "profile.h"
+#include "wire.h"
 
 namespace UFW
 {
@@ -66,6 +68,94 @@ Profile::Profile(QFile &file, bool isSys)
     }
 }
 
+Profile Profile::fromWire(const QByteArray &data)
+{
+    Profile       profile;
+    Wire::Decoder decoder(data);
+
+    if(!decoder.isValid())
+        return profile;
+
+    if(decoder.hasSection(Wire::SECTION_STATUS))
+    {
+        QByteArray  payload=decoder.section(Wire::SECTION_STATUS);
+        QDataStream stream(payload);
+        quint8      enabled=0;
+
+        stream >> enabled;
+        profile.enabled=enabled;
+        profile.fields|=FIELD_STATUS;
+    }
+
+    if(decoder.hasSection(Wire::SECTION_DEFAULTS))
+    {
+        QByteArray  payload=decoder.section(Wire::SECTION_DEFAULTS);
+        QDataStream stream(payload);
+        quint8      incoming=0,
+                    outgoing=0,
+                    logLevel=0,
+                    ipv6=0;
+
+        stream >> incoming >> outgoing >> logLevel >> ipv6;
+        profile.defaultIncomingPolicy=incoming<Types::POLICY_COUNT_DEFAULT ? (Types::Policy)incoming : Types::POLICY_ALLOW;
+        profile.defaultOutgoingPolicy=outgoing<Types::POLICY_COUNT_DEFAULT ? (Types::Policy)outgoing : Types::POLICY_ALLOW;
+        profile.logLevel=logLevel<Types::LOG_COUNT ? (Types::LogLevel)logLevel : Types::LOG_OFF;
+        profile.ipv6Enabled=ipv6;
+        profile.fields|=FIELD_DEFAULTS;
+    }
+
+    if(decoder.hasSection(Wire::SECTION_RULES))
+    {
+        QByteArray  payload=decoder.section(Wire::SECTION_RULES);
+        QDataStream stream(payload);
+        quint32     count=0;
+
+        stream >> count;
+        profile.rules.reserve(qMin(count, (quint32)payload.size()));
+        for(quint32 i=0; i<count && QDataStream::Ok==stream.status(); ++i)
+        {
+            quint8  action, flags, protocol, logging;
+            quint32 dapp, sapp, dport, sport, dst, src, ifaceIn, ifaceOut;
+
+            stream >> action >> flags >> protocol >> logging
+                   >> dapp >> sapp >> dport >> sport >> dst >> src >> ifaceIn >> ifaceOut;
+            if(QDataStream::Ok!=stream.status())
+                break;
+
+            Rule rule(action<Types::POLICY_COUNT ? (Types::Policy)action : Types::POLICY_ALLOW,
+                      flags&Wire::RULE_INCOMING,
+                      logging<Types::LOGGING_COUNT ? (Types::Logging)logging : Types::LOGGING_OFF,
+                      protocol<Types::PROTO_COUNT ? (Types::Protocol)protocol : Types::PROTO_BOTH,
+                      decoder.string(src), decoder.string(sport), decoder.string(dst), decoder.string(dport),
+                      decoder.string(ifaceIn), decoder.string(ifaceOut), decoder.string(sapp), decoder.string(dapp));
+
+            rule.setV6(flags&Wire::RULE_V6);
+            profile.rules.append(rule);
+        }
+        profile.fields|=FIELD_RULES;
+    }
+
+    if(decoder.hasSection(Wire::SECTION_MODULES))
+    {
+        QByteArray  payload=decoder.section(Wire::SECTION_MODULES);
+        QDataStream stream(payload);
+        quint32     count=0;
+
+        stream >> count;
+        for(quint32 i=0; i<count && QDataStream::Ok==stream.status(); ++i)
+        {
+            quint32 module;
+
+            stream >> module;
+            if(QDataStream::Ok==stream.status())
+                profile.modules.insert(decoder.string(module));
+        }
+        profile.fields|=FIELD_MODULES;
+    }
+
+    return profile;
+}
+
 QString Profile::toXml() const
 {
     QString                    str;
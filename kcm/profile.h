@@ -49,11 +49,14 @@ class Profile
     };
 
     Profile()
-        : fields(0), enabled(false), ipv6Enabled(false)
+        : fields(0), enabled(false), ipv6Enabled(false), logLevel(Types::LOG_OFF)
+        , defaultIncomingPolicy(Types::POLICY_ALLOW), defaultOutgoingPolicy(Types::POLICY_ALLOW), isSystem(false)
     {
     }
     Profile(const QByteArray &xml, bool isSys=false);
     Profile(QFile &file, bool isSys=false);
+    // Decode state, as sent by the helper - see common/wire.h
+    static Profile fromWire(const QByteArray &data);
     Profile(bool ipv6, Types::LogLevel ll, Types::Policy dip, Types::Policy dop, const QList<Rule> &r, const QSet<QString> &m)
         : fields(0xFF), enabled(true), ipv6Enabled(ipv6), logLevel(ll), defaultIncomingPolicy(dip), defaultOutgoingPolicy(dop)
         , rules(r), modules(m), isSystem(false)
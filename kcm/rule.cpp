@@ -23,6 +23,7 @@
 
 #include "rule.h"
 #include "appprofiles.h"
+#include "portnames.h"
 #include <KDE/KLocale>
 #include <QtCore/QMap>
 #include <QtCore/QByteArray>
@@ -63,24 +64,6 @@ static QString addIface(const QString &orig, const QString &iface)
     return iface.isEmpty() ? orig : i18nc("address on interface", "%1 on %2", orig, iface);
 }
 
-static QString getServiceName(short port)
-{
-    static QMap<int, QString> serviceMap;
-
-    if(serviceMap.contains(port))
-        return serviceMap[port];
-
-    struct servent *ent=getservbyport(htons(port), 0L);
-
-    if(ent && ent->s_name)
-    {
-        serviceMap[port]=ent->s_name;
-        return serviceMap[port];
-    }
-
-    return QString();
-}
-
 static QString formatPort(const QString &port, Types::Protocol prot)
 {
     return port.isEmpty() ? Rule::protocolSuffix(prot, QString())
@@ -123,27 +106,13 @@ static QString modifyPort(const QString &port, Types::Protocol prot, bool matchP
 {
     if(port.isEmpty())
         return port;
-    // Does it match a pre-configured application?
-    Types::PredefinedPort pp=Types::toPredefinedPort(port+Rule::protocolSuffix(prot));
-
-    // When matchin glog lines, the protocol is *always* specified - but dont alwys want this when
-    // matching names...
-    if(matchPortNoProto && Types::PP_COUNT==pp)
-         pp=Types::toPredefinedPort(port);
-
-    if(Types::PP_COUNT!=pp)
-        return i18nc("serice/application name (port numbers)", "%1 (%2)", Types::toString(pp, true), port+Rule::protocolSuffix(prot));
-
-    // Is it a service known to /etc/services ???
-    bool    ok(false);
-    QString service;
-    short   portNum=port.toShort(&ok);
 
-    if(ok)
-        service=getServiceName(portNum);
+    // Does it match a pre-configured application, or a service known to /etc/services? When matching log lines, the
+    // protocol is *always* specified - but dont always want this when matching names...
+    QString name=PortNames::get().name(port, prot, matchPortNoProto);
 
-    if(!service.isEmpty())
-        return i18nc("serice/application name (port numbers)", "%1 (%2)", service, formatPort(port, prot));
+    if(!name.isEmpty())
+        return i18nc("serice/application name (port numbers)", "%1 (%2)", name, formatPort(port, prot));
 
     // Just return port/sericename and protocol
     return formatPort(port, prot);
@@ -50,16 +50,24 @@ RulesList::~RulesList()
     grp.writeEntry(CFG_STATE, header()->saveState());
 }
 
-QTreeWidgetItem * RulesList::insert(const Rule &rule)
+// Append rule, or insert at index if this is >=0
+QTreeWidgetItem * RulesList::insert(const Rule &rule, int index)
 {
     static const QString pad(" "); // Add some padding so that when re-size treeview, there's a bigger gap
 
-    return new QTreeWidgetItem(this, QStringList() << rule.actionStr()+pad
-                                                   << rule.fromStr()+pad
-                                                   << rule.toStr()+pad
-                                                   << rule.ipV6Str()+pad
-                                                   << rule.loggingStr()+pad/*
-                                                   << rule.getDescription()+pad*/);
+    QStringList columns=QStringList() << rule.actionStr()+pad
+                                      << rule.fromStr()+pad
+                                      << rule.toStr()+pad
+                                      << rule.ipV6Str()+pad
+                                      << rule.loggingStr()+pad/*
+                                      << rule.getDescription()+pad*/;
+
+    if(index<0)
+        return new QTreeWidgetItem(this, columns);
+
+    QTreeWidgetItem *item=new QTreeWidgetItem(columns);
+    insertTopLevelItem(index, item);
+    return item;
 }
 
 void RulesList::resizeToContents()
@@ -52,7 +52,7 @@ class RulesList : public QTreeWidget
     virtual ~RulesList();
 
     void              resizeToContents();
-    QTreeWidgetItem * insert(const Rule &rule);
+    QTreeWidgetItem * insert(const Rule &rule, int index=-1);
     void              dropEvent(QDropEvent *event);
 
     public Q_SLOTS:
@@ -0,0 +1,79 @@
+#ifndef UFW_SPSC_QUEUE_H
+#define UFW_SPSC_QUEUE_H
+
+/*
+ * UFW KControl Module
+ *
+ * Copyright 2011 Craig Drummond <craig.p.drummond@gmail.com>
+ *
+ * ----
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <QtCore/QAtomicInt>
+
+namespace UFW
+{
+
+//
+// Fixed size queue of pointers, passed from one thread to another without locking. Only one thread may push items,
+// and only one (other) thread may pop them. Each thread only writes its own end of the queue - the item is stored
+// before the tail is moved past it (with release semantics), and the other thread reads the tail (with acquire
+// semantics) before the item. 'Size' must be a power of two.
+template<class T, int Size>
+class SpscQueue
+{
+    public:
+
+    SpscQueue() : head(0), tail(0) { }
+
+    // Producer only - returns false if the queue is full
+    bool push(T *item)
+    {
+        quint32 t=(int)tail;
+
+        if(t-(quint32)head.fetchAndAddAcquire(0)>=(quint32)Size)
+            return false;
+        items[t&(Size-1)]=item;
+        tail.fetchAndStoreRelease((int)(t+1));
+        return true;
+    }
+
+    // Consumer only - returns 0L if the queue is empty
+    T * pop()
+    {
+        quint32 h=(int)head;
+
+        if(h==(quint32)tail.fetchAndAddAcquire(0))
+            return 0L;
+
+        T *item=items[h&(Size-1)];
+
+        head.fetchAndStoreRelease((int)(h+1));
+        return item;
+    }
+
+    private:
+
+    QAtomicInt head,  // Only written by the consumer
+               tail;  // Only written by the producer
+    T          *items[Size];
+};
+
+}
+
+#endif